@@ -0,0 +1,344 @@
+/*************************************************************************/ /*
+ kcompat.h
+
+ Copyright (C) 2021 Renesas Electronics Corporation
+
+ License        Dual MIT/GPLv2
+
+ The contents of this file are subject to the MIT license as set out below.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ Alternatively, the contents of this file may be used under the terms of
+ the GNU General Public License Version 2 ("GPL") in which case the provisions
+ of GPL are applicable instead of those above.
+
+ If you wish to allow use of your version of this file only under the terms of
+ GPL, and not to allow others to use your version of this file under the terms
+ of the MIT license, indicate your decision by deleting the provisions above
+ and replace them with the notice and other provisions required by GPL as set
+ out in the file called "GPL-COPYING" included in this distribution. If you do
+ not delete the provisions above, a recipient may use your version of this file
+ under the terms of either the MIT license or GPL.
+
+ This License is also included in this distribution in the file called
+ "MIT-COPYING".
+
+ EXCEPT AS OTHERWISE STATED IN A NEGOTIATED AGREEMENT: (A) THE SOFTWARE IS
+ PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ PURPOSE AND NONINFRINGEMENT; AND (B) IN NO EVENT SHALL THE AUTHORS OR
+ COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+ GPLv2:
+ If you wish to use this file under the terms of GPL, following terms are
+ effective.
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; version 2 of the License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/ /*************************************************************************/
+#ifndef __KCOMPAT_H__
+#define __KCOMPAT_H__
+
+/*
+ * User space stand-ins for the kernel interfaces used by qos_core.c, so
+ * that the core can be built into the benchmark and run against the
+ * emulated register block of kcompat.c. Only the synchronous paths are
+ * functional: timers and work items are accepted but never run.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/types.h>
+
+typedef __u8 u8;
+typedef __u16 u16;
+typedef __u32 u32;
+typedef __u64 u64;
+typedef __s32 s32;
+typedef __s64 s64;
+
+#define __iomem
+#define __user
+
+#define fallthrough		__attribute__((__fallthrough__))
+#define READ_ONCE(x)		(*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)	(*(volatile __typeof__(x) *)&(x) = (v))
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define max(a, b)		((a) > (b) ? (a) : (b))
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define min_t(t, a, b)		((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b)		((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+
+#define printk(fmt, args...)	((void)0)
+#define pr_info(fmt, args...)	((void)0)
+#define pr_err(fmt, args...)	fprintf(stderr, fmt, ##args)
+
+static inline int fls64(u64 x)
+{
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+/* slab */
+#define GFP_KERNEL		0
+#define kcalloc(n, size, gfp)	calloc(n, size)
+#define kfree(p)		free((void *)(p))
+
+/* percpu: the benchmark is single threaded */
+#define DECLARE_PER_CPU(type, name)	extern __typeof__(type) name
+#define DEFINE_PER_CPU(type, name)	__typeof__(type) name
+#define this_cpu_inc(x)			((x)++)
+#define this_cpu_add(x, v)		((x) += (v))
+
+/* atomic */
+typedef struct { s64 counter; } atomic64_t;
+#define ATOMIC64_INIT(i)	{ (i) }
+
+static inline s64 atomic64_inc_return(atomic64_t *v)
+{
+	return __atomic_add_fetch(&v->counter, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline s64 atomic64_read(const atomic64_t *v)
+{
+	return __atomic_load_n(&v->counter, __ATOMIC_SEQ_CST);
+}
+
+/* list */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD(name)		struct list_head name = { &(name), &(name) }
+
+static inline void list_add_tail(struct list_head *entry,
+				 struct list_head *head)
+{
+	entry->prev = head->prev;
+	entry->next = head;
+	head->prev->next = entry;
+	head->prev = entry;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+#define list_for_each_entry(pos, head, member) \
+	for (pos = container_of((head)->next, __typeof__(*pos), member); \
+	     &pos->member != (head); \
+	     pos = container_of(pos->member.next, __typeof__(*pos), member))
+
+/* mutex, accounting how long it is held */
+struct mutex {
+	pthread_mutex_t lock;
+	u64 lock_ns;
+};
+
+#define DEFINE_MUTEX(name) \
+	struct mutex name = { PTHREAD_MUTEX_INITIALIZER, 0 }
+
+struct kcompat_lock_stats {
+	u64 count;
+	u64 hold_ns;
+	u64 max_ns;
+};
+
+extern struct kcompat_lock_stats kcompat_mutex_stats;
+
+void mutex_lock(struct mutex *lock);
+void mutex_unlock(struct mutex *lock);
+
+/* seqlock */
+typedef struct {
+	unsigned int seq;
+	pthread_mutex_t lock;
+} seqlock_t;
+
+#define DEFINE_SEQLOCK(name) \
+	seqlock_t name = { 0, PTHREAD_MUTEX_INITIALIZER }
+
+void write_seqlock(seqlock_t *sl);
+void write_sequnlock(seqlock_t *sl);
+unsigned int read_seqbegin(const seqlock_t *sl);
+unsigned int read_seqretry(const seqlock_t *sl, unsigned int start);
+
+#define write_seqlock_irqsave(sl, flags) \
+	do { (flags) = 0; write_seqlock(sl); } while (0)
+#define write_sequnlock_irqrestore(sl, flags) \
+	do { (void)(flags); write_sequnlock(sl); } while (0)
+
+/* time */
+typedef s64 ktime_t;
+
+#define NSEC_PER_USEC		1000L
+
+u64 ktime_get_ns(void);
+
+static inline ktime_t ns_to_ktime(u64 ns)
+{
+	return ns;
+}
+
+void udelay(unsigned long usecs);
+void usleep_range(unsigned long min, unsigned long max);
+
+/* hrtimer and workqueue, never fired */
+#define CLOCK_MONOTONIC		1
+
+enum hrtimer_restart { HRTIMER_NORESTART, HRTIMER_RESTART };
+enum hrtimer_mode { HRTIMER_MODE_ABS, HRTIMER_MODE_REL };
+
+struct hrtimer {
+	enum hrtimer_restart (*function)(struct hrtimer *timer);
+};
+
+static inline void hrtimer_init(struct hrtimer *timer, int clock,
+				enum hrtimer_mode mode)
+{
+}
+
+static inline void hrtimer_start(struct hrtimer *timer, ktime_t tim,
+				 enum hrtimer_mode mode)
+{
+}
+
+static inline int hrtimer_cancel(struct hrtimer *timer)
+{
+	return 0;
+}
+
+static inline int hrtimer_try_to_cancel(struct hrtimer *timer)
+{
+	return 0;
+}
+
+static inline u64 hrtimer_forward_now(struct hrtimer *timer,
+				      ktime_t interval)
+{
+	return 0;
+}
+
+struct work_struct {
+	void (*func)(struct work_struct *work);
+};
+
+#define INIT_WORK(work, fn)	((work)->func = (fn))
+
+static inline bool schedule_work(struct work_struct *work)
+{
+	return false;
+}
+
+static inline bool cancel_work_sync(struct work_struct *work)
+{
+	return false;
+}
+
+typedef struct { int unused; } wait_queue_head_t;
+
+#define DECLARE_WAIT_QUEUE_HEAD(name)	wait_queue_head_t name
+#define wait_event(wq, cond)		do { } while (!(cond))
+
+static inline void wake_up_all(wait_queue_head_t *wq)
+{
+}
+
+/* The benchmark follows the current kernel API where it differs */
+#define KERNEL_VERSION(a, b, c)	(((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE	KERNEL_VERSION(6, 8, 0)
+
+struct eventfd_ctx;
+
+static inline void eventfd_signal(struct eventfd_ctx *ctx)
+{
+}
+
+/* cred, mm and device, only named in prototypes */
+struct cred;
+struct vm_area_struct;
+struct device;
+
+/* MMIO and device tree, backed by the emulated register block */
+struct device_node;
+
+u32 readl(const volatile void __iomem *addr);
+void writel(u32 value, volatile void __iomem *addr);
+u64 readq(const volatile void __iomem *addr);
+void writeq(u64 value, volatile void __iomem *addr);
+#define readq readq
+#define writeq writeq
+
+/* User space memory needs no barriers, so relaxed accesses are the same */
+#define readl_relaxed(addr)		readl(addr)
+#define writel_relaxed(value, addr)	writel(value, addr)
+#define readq_relaxed(addr)		readq(addr)
+#define writeq_relaxed(value, addr)	writeq(value, addr)
+
+void __iowrite64_copy(void __iomem *to, const void *from, size_t count);
+void memcpy_fromio(void *to, const volatile void __iomem *from, size_t count);
+
+void __iomem *ioremap(unsigned long phys, size_t size);
+void iounmap(volatile void __iomem *addr);
+struct device_node *of_find_compatible_node(struct device_node *from,
+					    const char *type,
+					    const char *compat);
+void __iomem *of_iomap(struct device_node *np, int index);
+void of_node_put(struct device_node *np);
+
+/* tracepoints compile away */
+#define TP_PROTO(args...)	args
+#define TP_ARGS(args...)	args
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) {}
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args) \
+	static inline void trace_##name(proto) {}
+
+/* Emulated register block */
+#define KCOMPAT_REG_SIZE	(0x00010000U)
+
+struct kcompat_soc {
+	const char *name;
+	u32 prr;
+	u32 s4n;
+};
+
+void kcompat_reg_init(const struct kcompat_soc *soc, u64 switch_delay_ns);
+void kcompat_reg_exit(void);
+void kcompat_reg_reset(void);
+
+#endif /* __KCOMPAT_H__ */
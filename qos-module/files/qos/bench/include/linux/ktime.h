@@ -0,0 +1,2 @@
+/* Benchmark stand-in, see kcompat.h */
+#include <kcompat.h>
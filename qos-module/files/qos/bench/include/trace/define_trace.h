@@ -0,0 +1 @@
+/* Benchmark stand-in: tracepoints are not instantiated */
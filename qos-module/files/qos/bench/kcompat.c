@@ -0,0 +1,264 @@
+/*************************************************************************/ /*
+ kcompat.c
+
+ Copyright (C) 2021 Renesas Electronics Corporation
+
+ License        Dual MIT/GPLv2
+
+ The contents of this file are subject to the MIT license as set out below.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ Alternatively, the contents of this file may be used under the terms of
+ the GNU General Public License Version 2 ("GPL") in which case the provisions
+ of GPL are applicable instead of those above.
+
+ If you wish to allow use of your version of this file only under the terms of
+ GPL, and not to allow others to use your version of this file under the terms
+ of the MIT license, indicate your decision by deleting the provisions above
+ and replace them with the notice and other provisions required by GPL as set
+ out in the file called "GPL-COPYING" included in this distribution. If you do
+ not delete the provisions above, a recipient may use your version of this file
+ under the terms of either the MIT license or GPL.
+
+ This License is also included in this distribution in the file called
+ "MIT-COPYING".
+
+ EXCEPT AS OTHERWISE STATED IN A NEGOTIATED AGREEMENT: (A) THE SOFTWARE IS
+ PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ PURPOSE AND NONINFRINGEMENT; AND (B) IN NO EVENT SHALL THE AUTHORS OR
+ COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+ GPLv2:
+ If you wish to use this file under the terms of GPL, following terms are
+ effective.
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; version 2 of the License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/ /*************************************************************************/
+
+#include <time.h>
+
+#include <kcompat.h>
+
+#include "qos_reg.h"
+
+uint32_t qos_base;
+void __iomem *qos_reg_base;
+
+struct kcompat_lock_stats kcompat_mutex_stats;
+
+/*
+ * QOSCTRL_MEMBANK is emulated: a write requests bank bit 0, and the
+ * executing bank in bit 8 follows it once switch_delay_ns have elapsed.
+ * Every other register is plain memory.
+ */
+static __u8 *reg_block;
+static u32 prr_reg;
+static u32 s4n_reg;
+static u32 membank_req;
+static u32 membank_exe;
+static u64 membank_write_ns;
+static u64 switch_delay_ns;
+
+u64 ktime_get_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void udelay(unsigned long usecs)
+{
+	u64 end = ktime_get_ns() + usecs * NSEC_PER_USEC;
+
+	while (ktime_get_ns() < end)
+		;
+}
+
+void usleep_range(unsigned long min, unsigned long max)
+{
+	struct timespec ts = {
+		.tv_sec = min / 1000000,
+		.tv_nsec = (min % 1000000) * NSEC_PER_USEC,
+	};
+
+	nanosleep(&ts, NULL);
+}
+
+void mutex_lock(struct mutex *lock)
+{
+	pthread_mutex_lock(&lock->lock);
+	lock->lock_ns = ktime_get_ns();
+}
+
+void mutex_unlock(struct mutex *lock)
+{
+	u64 hold = ktime_get_ns() - lock->lock_ns;
+
+	kcompat_mutex_stats.count++;
+	kcompat_mutex_stats.hold_ns += hold;
+	if (hold > kcompat_mutex_stats.max_ns)
+		kcompat_mutex_stats.max_ns = hold;
+
+	pthread_mutex_unlock(&lock->lock);
+}
+
+void write_seqlock(seqlock_t *sl)
+{
+	pthread_mutex_lock(&sl->lock);
+	__atomic_add_fetch(&sl->seq, 1, __ATOMIC_RELEASE);
+}
+
+void write_sequnlock(seqlock_t *sl)
+{
+	__atomic_add_fetch(&sl->seq, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&sl->lock);
+}
+
+unsigned int read_seqbegin(const seqlock_t *sl)
+{
+	unsigned int seq;
+
+	while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1)
+		;
+
+	return seq;
+}
+
+unsigned int read_seqretry(const seqlock_t *sl, unsigned int start)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != start;
+}
+
+static bool is_membank(const volatile void __iomem *addr)
+{
+	return reg_block && (addr == reg_block + QOSCTRL_MEMBANK);
+}
+
+u32 readl(const volatile void __iomem *addr)
+{
+	if (is_membank(addr)) {
+		if (ktime_get_ns() - membank_write_ns >= switch_delay_ns)
+			membank_exe = membank_req;
+		return membank_req | (membank_exe << 8);
+	}
+
+	return *(const volatile u32 *)addr;
+}
+
+void writel(u32 value, volatile void __iomem *addr)
+{
+	if (is_membank(addr)) {
+		membank_req = value & 0x00000001;
+		membank_write_ns = ktime_get_ns();
+		return;
+	}
+
+	*(volatile u32 *)addr = value;
+}
+
+u64 readq(const volatile void __iomem *addr)
+{
+	return *(const volatile u64 *)addr;
+}
+
+void writeq(u64 value, volatile void __iomem *addr)
+{
+	*(volatile u64 *)addr = value;
+}
+
+void __iowrite64_copy(void __iomem *to, const void *from, size_t count)
+{
+	const u64 *src = from;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		writeq(src[i], (volatile __u8 __iomem *)to + i * 8);
+}
+
+void memcpy_fromio(void *to, const volatile void __iomem *from, size_t count)
+{
+	memcpy(to, (const void *)from, count);
+}
+
+void __iomem *ioremap(unsigned long phys, size_t size)
+{
+	return (phys == S4N_IDENTIFIER) ? &s4n_reg : NULL;
+}
+
+void iounmap(volatile void __iomem *addr)
+{
+}
+
+struct device_node *of_find_compatible_node(struct device_node *from,
+					    const char *type,
+					    const char *compat)
+{
+	return (struct device_node *)&prr_reg;
+}
+
+void __iomem *of_iomap(struct device_node *np, int index)
+{
+	return &prr_reg;
+}
+
+void of_node_put(struct device_node *np)
+{
+}
+
+void kcompat_reg_init(const struct kcompat_soc *soc, u64 delay_ns)
+{
+	reg_block = aligned_alloc(4096, KCOMPAT_REG_SIZE);
+	memset(reg_block, 0, KCOMPAT_REG_SIZE);
+	qos_reg_base = reg_block;
+
+	prr_reg = soc->prr;
+	s4n_reg = soc->s4n;
+	membank_req = 0;
+	membank_exe = 0;
+	membank_write_ns = 0;
+	switch_delay_ns = delay_ns;
+}
+
+/* Power loss: the tables and QOSCTRL_MEMBANK go back to zero */
+void kcompat_reg_reset(void)
+{
+	memset(reg_block, 0, KCOMPAT_REG_SIZE);
+	membank_req = 0;
+	membank_exe = 0;
+	membank_write_ns = 0;
+}
+
+void kcompat_reg_exit(void)
+{
+	free(reg_block);
+	reg_block = NULL;
+	qos_reg_base = NULL;
+}
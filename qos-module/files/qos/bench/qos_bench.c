@@ -0,0 +1,282 @@
+/*************************************************************************/ /*
+ qos_bench.c
+
+ Copyright (C) 2021 Renesas Electronics Corporation
+
+ License        Dual MIT/GPLv2
+
+ The contents of this file are subject to the MIT license as set out below.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ Alternatively, the contents of this file may be used under the terms of
+ the GNU General Public License Version 2 ("GPL") in which case the provisions
+ of GPL are applicable instead of those above.
+
+ If you wish to allow use of your version of this file only under the terms of
+ GPL, and not to allow others to use your version of this file under the terms
+ of the MIT license, indicate your decision by deleting the provisions above
+ and replace them with the notice and other provisions required by GPL as set
+ out in the file called "GPL-COPYING" included in this distribution. If you do
+ not delete the provisions above, a recipient may use your version of this file
+ under the terms of either the MIT license or GPL.
+
+ This License is also included in this distribution in the file called
+ "MIT-COPYING".
+
+ EXCEPT AS OTHERWISE STATED IN A NEGOTIATED AGREEMENT: (A) THE SOFTWARE IS
+ PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ PURPOSE AND NONINFRINGEMENT; AND (B) IN NO EVENT SHALL THE AUTHORS OR
+ COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+ GPLv2:
+ If you wish to use this file under the terms of GPL, following terms are
+ effective.
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; version 2 of the License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/ /*************************************************************************/
+
+#include <getopt.h>
+
+#include <kcompat.h>
+
+#include "qos_core.h"
+#include "qos_reg.h"
+
+DEFINE_PER_CPU(struct qos_stats, qos_stats);
+
+#define BENCH_ITERATIONS_DEFAULT	(1000)
+#define BENCH_SWITCH_DELAY_NS_DEFAULT	(5000)
+
+/* One entry per supported SoC and cut with a distinct master_id_max */
+static const struct kcompat_soc bench_socs[] = {
+	{ "H3-ES2.0",	R_CAR_H3 | ES20,	0 },
+	{ "M3-W",	R_CAR_M3_W | ES20,	0 },
+	{ "M3-N",	R_CAR_M3_N | ES10,	0 },
+	{ "D3",		R_CAR_D3 | ES10,	0 },
+	{ "E3",		R_CAR_E3 | ES10,	0 },
+	{ "V3U",	R_CAR_V3U | ES10,	0 },
+	{ "V3H",	R_CAR_V3H | ES20,	0 },
+	{ "V3M",	R_CAR_V3M | ES20,	0 },
+	{ "V4H",	R_CAR_V4H | ES21,	0 },
+	{ "S4",		R_CAR_S4 | ES12,	0 },
+	{ "S4N",	R_CAR_S4 | ES12,	1 },
+	{ "V4M",	R_CAR_V4M | ES10,	0 },
+	{ "H3-ES1.1",	R_CAR_H3 | ES11,	0 },
+};
+
+static __u64 tables[2][2][MASTER_ID_MAX + 1];
+static __u64 *samples;
+
+static void bench_set_all_qos(int i)
+{
+	struct qos_ioc_set_all_qos_param param = {
+		.fix_qos = (__u8 *)tables[i & 1][QOS_TYPE_FIX],
+		.be_qos = (__u8 *)tables[i & 1][QOS_TYPE_BE],
+	};
+
+	rcar_qos_set_all_qos(&param);
+}
+
+static void bench_set_all_qos_same(int i)
+{
+	struct qos_ioc_set_all_qos_param param = {
+		.fix_qos = (__u8 *)tables[0][QOS_TYPE_FIX],
+		.be_qos = (__u8 *)tables[0][QOS_TYPE_BE],
+	};
+
+	rcar_qos_set_all_qos(&param);
+}
+
+static void bench_set_ip_qos(int i)
+{
+	struct qos_ioc_set_ip_qos_param ip_qos = {
+		.qos_type = QOS_TYPE_BE,
+		.master_id = i % (rcar_qos_get_master_id_max() + 1),
+		.qos = tables[i & 1][QOS_TYPE_BE][0],
+	};
+
+	rcar_qos_set_ip_qos(&ip_qos, NULL, 1);
+}
+
+static void bench_switch_membank(int i)
+{
+	rcar_qos_switch_membank();
+}
+
+static void bench_commit_qos_table(int i)
+{
+	__u8 exe_membank;
+
+	rcar_qos_commit_qos_table(tables[i & 1][QOS_TYPE_FIX],
+				  tables[i & 1][QOS_TYPE_BE],
+				  rcar_qos_get_master_id_max() + 1,
+				  &exe_membank);
+}
+
+static void bench_suspend_resume(int i)
+{
+	rcar_qos_suspend();
+	rcar_qos_resume();
+}
+
+static void bench_suspend_resume_lost(int i)
+{
+	rcar_qos_suspend();
+	kcompat_reg_reset();
+	rcar_qos_resume();
+}
+
+static const struct {
+	const char *name;
+	void (*fn)(int i);
+} bench_ops[] = {
+	{ "set_all_qos",	bench_set_all_qos },
+	{ "set_all_qos_same",	bench_set_all_qos_same },
+	{ "set_ip_qos",		bench_set_ip_qos },
+	{ "switch_membank",	bench_switch_membank },
+	{ "commit_qos_table",	bench_commit_qos_table },
+	{ "suspend_resume",	bench_suspend_resume },
+	{ "suspend_resume_lost", bench_suspend_resume_lost },
+};
+
+static int cmp_u64(const void *a, const void *b)
+{
+	__u64 x = *(const __u64 *)a;
+	__u64 y = *(const __u64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void bench_run(const char *soc, int op, int iterations)
+{
+	__u64 sum = 0;
+	__u64 start;
+	int i;
+
+	memset(&qos_stats, 0, sizeof(qos_stats));
+	memset(&kcompat_mutex_stats, 0, sizeof(kcompat_mutex_stats));
+
+	for (i = 0; i < iterations; i++) {
+		start = ktime_get_ns();
+		bench_ops[op].fn(i);
+		samples[i] = ktime_get_ns() - start;
+		sum += samples[i];
+	}
+
+	qsort(samples, iterations, sizeof(*samples), cmp_u64);
+
+	printf("%-9s %4d %-19s %9llu %9llu %9llu %9llu %8.1f %8.1f %9llu %9llu %6llu\n",
+	       soc, rcar_qos_get_master_id_max(), bench_ops[op].name,
+	       sum / iterations, samples[iterations / 2],
+	       samples[iterations * 99 / 100], samples[iterations - 1],
+	       (double)qos_stats.count[QOS_STAT_MMIO_READ] / iterations,
+	       (double)qos_stats.count[QOS_STAT_MMIO_WRITE] / iterations,
+	       kcompat_mutex_stats.count ?
+			kcompat_mutex_stats.hold_ns / kcompat_mutex_stats.count : 0,
+	       kcompat_mutex_stats.max_ns,
+	       qos_stats.count[QOS_STAT_SWITCH_TIMEOUT]);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-n iterations] [-d switch_delay_ns] [-s soc]\n",
+		prog);
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations = BENCH_ITERATIONS_DEFAULT;
+	__u64 delay_ns = BENCH_SWITCH_DELAY_NS_DEFAULT;
+	const char *soc = NULL;
+	size_t n;
+	int op;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "n:d:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'd':
+			delay_ns = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			soc = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return (opt == 'h') ? 0 : 1;
+		}
+	}
+
+	if (iterations <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	samples = calloc(iterations, sizeof(*samples));
+	if (!samples)
+		return 1;
+
+	for (i = 0; i <= MASTER_ID_MAX; i++) {
+		tables[0][QOS_TYPE_FIX][i] = 0x0000000100000000ULL | i;
+		tables[0][QOS_TYPE_BE][i] = 0x0000000200000000ULL | i;
+		tables[1][QOS_TYPE_FIX][i] = 0x0000000300000000ULL | i;
+		tables[1][QOS_TYPE_BE][i] = 0x0000000400000000ULL | i;
+	}
+
+	printf("switch completion delay %llu ns, %d iterations, times in ns\n",
+	       (unsigned long long)delay_ns, iterations);
+	printf("%-9s %4s %-19s %9s %9s %9s %9s %8s %8s %9s %9s %6s\n",
+	       "soc", "mid", "operation", "mean", "p50", "p99", "max",
+	       "mmio_rd", "mmio_wr", "lock_avg", "lock_max", "tmo");
+
+	for (n = 0; n < sizeof(bench_socs) / sizeof(bench_socs[0]); n++) {
+		if (soc && strcmp(soc, bench_socs[n].name))
+			continue;
+
+		kcompat_reg_init(&bench_socs[n], delay_ns);
+		if (rcar_qos_init()) {
+			fprintf(stderr, "%s: init failed\n", bench_socs[n].name);
+			rcar_qos_exit();
+			kcompat_reg_exit();
+			continue;
+		}
+
+		for (op = 0; op < sizeof(bench_ops) / sizeof(bench_ops[0]); op++)
+			bench_run(bench_socs[n].name, op, iterations);
+
+		rcar_qos_exit();
+		kcompat_reg_exit();
+	}
+
+	free(samples);
+
+	return 0;
+}
@@ -60,15 +60,26 @@
 */ /*************************************************************************/
 
 #include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/atomic.h>
 #include <linux/slab.h>
 #include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/eventfd.h>
 #include <linux/ioport.h>
 #include <linux/io.h>
 #include <linux/of_address.h>
+#include <linux/version.h>
 
 #include "qos_core.h"
 #include "qos_reg.h"
 
+#define CREATE_TRACE_POINTS
+#include "qos_trace.h"
+
 /* #define DEBUG */
 
 #ifdef DEBUG
@@ -78,28 +89,31 @@
 #define QOS_DBG(fmt, args...) do { } while (0)
 #endif
 
-#ifndef readq
-#define readq(addr) (readl(addr) | (((__u64) readl((addr) + 4)) << 32))
-#endif
+#define QOS_BANK_NUM		(2)
+#define QOS_SHADOW_TYPE_NUM	(QOS_TYPE_BE + 1)
 
-#ifndef writeq
-#define writeq(val, addr) do { \
-	writel((__u32) (val), (addr)); \
-	writel((__u32) ((val) >> 32), (addr) + 4); \
-} while (0)
-#endif
+#define QOS_SHADOW(__type, __bank) \
+	(qos_shadow + \
+	 ((__type) * QOS_BANK_NUM + (__bank)) * QOS_MASTER_NUM)
 
-#define READ_REG32(address)		readl(address)
-#define READ_REG64(address)		readq(address)
-#define WRITE_REG32(value, address)	writel(value, address)
-#define WRITE_REG64(value, address)	writeq(value, address)
+static DEFINE_MUTEX(qos_mutex);
 
-#define QOS_BANK_OFF(__index) (QOS_BANK_SIZE * (__index))
+/* Take qos_mutex, accounting the time spent waiting for it */
+static void qos_mutex_lock(void)
+{
+	__u64 start = qos_stats_ns();
 
-extern uint32_t qos_base;				// Physical address of QoS module
-extern void __iomem *qos_reg_base;		// Vitural address of QoS module
+	mutex_lock(&qos_mutex);
+	qos_stats_hist(QOS_HIST_MUTEX_WAIT_NS, qos_stats_ns() - start);
+}
 
-static DEFINE_MUTEX(qos_mutex);
+/*
+ * Publishes the shadow contents, their valid flags and the cached bank and
+ * status values. Writers are already serialised by qos_mutex and take the
+ * write side around each update; queries read under the sequence count
+ * and retry, so they never wait for a writer, even one polling a switch.
+ */
+static DEFINE_SEQLOCK(qos_shadow_lock);
 
 static __u32 device, device_version;
 static int master_id_max;
@@ -107,32 +121,200 @@ static int init;
 static __u8 exe_membank_bk;
 static bool support_exe_membank = true;
 
-static __u8 fix_qos_buf[QOS_FIX_BANK_SIZE] = {};
-static __u8 be_qos_buf[QOS_BE_BANK_SIZE] = {};
+/*
+ * Number of master IDs used to size and walk the banks. A build for a
+ * single SoC (QOS_SOC in the Makefile) makes it a constant, so the bank
+ * loops have a fixed trip count.
+ */
+#ifdef QOS_SOC_MASTER_ID_MAX
+#define QOS_MASTER_NUM		(QOS_SOC_MASTER_ID_MAX + 1)
+#else
+#define QOS_MASTER_NUM		(master_id_max + 1)
+#endif
 
-static __u8 backup_bank[QOS_REG_SIZE];
+/*
+ * How bank contents are moved to and from the registers. The entries of a
+ * bank need no ordering among themselves: only the QOSCTRL_MEMBANK write
+ * has to observe them, and writel() orders it after every earlier relaxed
+ * access, so that barrier is the only one paid per switch.
+ */
+enum {
+	QOS_XFER_ORDERED = 0,	/* readq/writeq per entry */
+	QOS_XFER_RELAXED,	/* readq_relaxed/writeq_relaxed per entry */
+	QOS_XFER_BURST,		/* __iowrite64_copy/memcpy_fromio per run */
+	QOS_XFER_LO_HI,		/* relaxed 32-bit pairs, low word first */
+};
+
+static int bank_xfer = QOS_XFER_ORDERED;
+
+struct qos_soc_info {
+	__u32 product;
+	__u32 cut_min;
+	__u32 cut_max;
+	int master_id_max;
+	bool exe_membank;	/* QOSCTRL_MEMBANK reports the executing bank */
+	bool s4n;		/* only when S4N_IDENTIFIER is set */
+	int xfer;
+	const char *name;
+};
+
+/* Searched in order, the first match wins */
+static const struct qos_soc_info qos_socs[] = {
+	{ R_CAR_H3, ES10, ES11, MASTER_ID_MAX_H3_ES1, false, false,
+	  QOS_XFER_ORDERED, "R-Car H3" },
+	{ R_CAR_H3, ES12, CUT_NUMBER_MASK, MASTER_ID_MAX_H3_ES2, true, false,
+	  QOS_XFER_RELAXED, "R-Car H3" },
+	{ R_CAR_M3_W, ES10, CUT_NUMBER_MASK, MASTER_ID_MAX_M3_W, true, false,
+	  QOS_XFER_RELAXED, "R-Car M3" },
+	{ R_CAR_M3_N, ES10, CUT_NUMBER_MASK, MASTER_ID_MAX_M3_N, true, false,
+	  QOS_XFER_RELAXED, "R-Car M3N" },
+	{ R_CAR_D3, ES10, CUT_NUMBER_MASK, MASTER_ID_MAX_D3, true, false,
+	  QOS_XFER_RELAXED, "R-Car D3" },
+	{ R_CAR_E3, ES10, CUT_NUMBER_MASK, MASTER_ID_MAX_E3, true, false,
+	  QOS_XFER_RELAXED, "R-Car E3" },
+	{ R_CAR_V3U, ES10, CUT_NUMBER_MASK, MASTER_ID_MAX_V3U, true, false,
+	  QOS_XFER_BURST, "R-Car V3U" },
+	{ R_CAR_V3H, ES10, CUT_NUMBER_MASK, MASTER_ID_MAX_V3H, true, false,
+	  QOS_XFER_RELAXED, "R-Car V3H" },
+	{ R_CAR_V3M, ES10, CUT_NUMBER_MASK, MASTER_ID_MAX_V3M, true, false,
+	  QOS_XFER_RELAXED, "R-Car V3M" },
+	{ R_CAR_V4H, ES10, CUT_NUMBER_MASK, MASTER_ID_MAX_V4H, true, false,
+	  QOS_XFER_BURST, "R-Car V4H" },
+	{ R_CAR_S4, ES10, CUT_NUMBER_MASK, MASTER_ID_MAX_S4, true, true,
+	  QOS_XFER_BURST, "R-Car S4N" },
+	{ R_CAR_S4, ES10, CUT_NUMBER_MASK, MASTER_ID_MAX_S4, true, false,
+	  QOS_XFER_BURST, "R-Car S4" },
+	{ R_CAR_V4M, ES10, CUT_NUMBER_MASK, MASTER_ID_MAX_V4M, true, false,
+	  QOS_XFER_BURST, "R-Car V4M" },
+};
+
+/*
+ * Kernel copy of what is programmed in each bank of the FIX and BE tables,
+ * laid out as [type][bank][master_id_max + 1]. A bank whose shadow is not
+ * valid yet is read back from the hardware or fully rewritten on first use.
+ */
+static __u64 *qos_shadow;
+static bool qos_shadow_valid[QOS_SHADOW_TYPE_NUM][QOS_BANK_NUM];
+
+/*
+ * Set while the standby bank holds entries staged for the next switch, and
+ * cleared once a switch has taken them live or qos_bank_restage() has
+ * dropped them. Protected by qos_mutex.
+ */
+static bool standby_staged;
+
+/*
+ * Generation of the last switch that changed each executing FIX and BE
+ * entry, laid out as [type][master_id_max + 1]. A transaction records
+ * qos_commit_gen when it begins, and entries stamped later conflict with it.
+ */
+static __u64 *qos_entry_gen;
+static __u64 qos_commit_gen;
+
+#define QOS_ENTRY_GEN(__type) \
+	(qos_entry_gen + (__type) * QOS_MASTER_NUM)
+
+/*
+ * Asynchronous bank switch. The QOSCTRL_MEMBANK write is issued from the
+ * ioctl, or from qos_switch_timer at an absolute deadline for a scheduled
+ * switch. Completion is polled from qos_switch_timer and the bookkeeping
+ * (exe_membank_bk, standby resync, notification) is finished under
+ * qos_mutex, either by qos_switch_work or by the next caller.
+ */
+enum {
+	QOS_SWITCH_IDLE = 0,
+	QOS_SWITCH_ARMED,	/* waiting for its deadline to write the register */
+	QOS_SWITCH_PENDING,	/* QOSCTRL_MEMBANK written, not yet applied */
+	QOS_SWITCH_DONE,	/* applied or timed out, not yet finished */
+};
+
+static DEFINE_SEQLOCK(qos_switch_lock);
+static DECLARE_WAIT_QUEUE_HEAD(qos_switch_wq);
+static LIST_HEAD(qos_switch_notifiers);
+static struct hrtimer qos_switch_timer;
+static struct work_struct qos_switch_work;
+static int switch_state;
+static int switch_retry;
+static int switch_result;
+static __u32 switch_target;
+static __u32 switch_value;
+static __u64 switch_seq;
+static __u64 switch_done_seq;
+static __u64 switch_deadline_ns;
+static __u64 switch_kick_ns;
+static __u64 switch_done_ns;
+
+/* Coalescing of synchronous switches, see rcar_qos_switch_membank() */
+static atomic64_t switch_req_ticket = ATOMIC64_INIT(0);
+static __u64 switch_sync_done_ticket;
+static int switch_sync_result;
 
 #define WAIT_SWITCH_BANK_US_MIN	(100)
 #define WAIT_SWITCH_BANK_US_MAX	(1000)
 #define WAIT_SWITCH_BANK_US	(10)
 #define WAIT_RETRY_COUNT		(5)
 
-static inline void qos_reg_load(void *src, __u32 offset, int index);
-static inline void qos_reg_store(void *dst, __u32 offset, int index);
+static void qos_bank_load(const __u64 *src, __u32 offset, int first, int num);
+static void qos_bank_store(__u64 *dst, __u32 offset, int num);
 static int rcar_qos_wait_switching(__u32 value);
+static void qos_bank_sync(int type, __u32 bank);
+static int qos_bank_update(int type, __u32 bank, const __u64 *src, int num);
+static void qos_entry_update(int type, __u32 bank, int index, __u64 value);
+static enum hrtimer_restart qos_switch_timer_fn(struct hrtimer *timer);
+static void qos_switch_work_fn(struct work_struct *work);
+static int qos_switch_settle(void);
+static int qos_switch_cancel(void);
+
+static bool qos_soc_is_s4n(void)
+{
+	void __iomem *s4n_identifier_reg;
+	__u32 s4n_identifier;
+
+	s4n_identifier_reg = ioremap(S4N_IDENTIFIER, sizeof(uint32_t));
+	if (!s4n_identifier_reg)
+		return false;
+
+	s4n_identifier = readl(s4n_identifier_reg) & 0x00000001;
+	iounmap((void *)s4n_identifier_reg);
+
+	return s4n_identifier;
+}
+
+static const struct qos_soc_info *qos_soc_lookup(__u32 product, __u32 cut)
+{
+	const struct qos_soc_info *soc;
+	int s4n = -1;
+
+	for (soc = qos_socs; soc < qos_socs + ARRAY_SIZE(qos_socs); soc++) {
+		if ((soc->product != product) ||
+		    (cut < soc->cut_min) || (cut > soc->cut_max))
+			continue;
+
+		if (soc->s4n) {
+			if (s4n < 0)
+				s4n = qos_soc_is_s4n();
+			if (!s4n)
+				continue;
+		}
+
+		return soc;
+	}
+
+	return NULL;
+}
 
 int rcar_qos_init(void)
 {
 	int ret = 0;
 
-	__u32 prr, s4n_identifier;
+	__u32 prr;
+	const struct qos_soc_info *soc;
 	struct device_node *np;
 	void __iomem *prr_reg_base = NULL;
-	void __iomem *s4n_identifier_reg = NULL;
 
 	QOS_DBG("begin");
 
-	mutex_lock(&qos_mutex);
+	qos_mutex_lock();
 
 	if (!init) {
         /* Try PRR first, then hardcoded fallback */
@@ -156,152 +338,21 @@ int rcar_qos_init(void)
 			ret = -ENOMEM;
 		}
 
-		if (device == R_CAR_H3) {
-			switch (device_version) {
-			case ES10:
-				pr_info("Device \"R-Car H3 Ver.1.0\"\r\n");
-				fallthrough;
-			case ES11:
-				pr_info("Device \"R-Car H3 Ver1.1\"\r\n");
-				master_id_max = MASTER_ID_MAX_H3_ES1;
-				support_exe_membank = false;
-				break;
-			case ES20:
-				pr_info("Device \"R-Car H3 Ver2.0\"\r\n");
-				fallthrough;
-			default:
-				master_id_max = MASTER_ID_MAX_H3_ES2;
-				break;
-			}
-		} else if (device == R_CAR_M3_W) {
-			switch (device_version) {
-			case ES10:
-				pr_info("Device \"R-Car M3 Ver1.0\"\r\n");
-				fallthrough;
-			case ES20: /* Ver1.1 */
-				pr_info("Device \"R-Car M3 Ver1.1\"\r\n");
-				fallthrough;
-			default:
-				master_id_max = MASTER_ID_MAX_M3_W;
-				break;
-			}
-		} else if (device == R_CAR_M3_N) {
-			switch (device_version) {
-			case ES10:
-				pr_info("Device \"R-Car M3N Ver1.0\"\r\n");
-				fallthrough;
-			default:
-				master_id_max = MASTER_ID_MAX_M3_N;
-				break;
-			}
-		} else if (device == R_CAR_D3) {
-			switch (device_version) {
-			case ES10:
-				pr_info("Device \"R-Car D3 Ver1.0\"\r\n");
-				fallthrough;
-			default:
-				master_id_max = MASTER_ID_MAX_D3;
-				break;
-			}
-		} else if (device == R_CAR_E3) {
-			switch (device_version) {
-			case ES10:
-				pr_info("Device \"R-Car E3 Ver1.0\"\r\n");
-				fallthrough;
-			default:
-				master_id_max = MASTER_ID_MAX_E3;
-				break;
-			}
-		} else if (device == R_CAR_V3U) {
-			switch (device_version) {
-			case ES10:
-				pr_info("Device \"R-Car V3U Ver1.0\"\r\n");
-				fallthrough;
-			default:
-				master_id_max = MASTER_ID_MAX_V3U;
-				break;
-			}
-		} else if (device == R_CAR_V3H) {
-			switch (device_version) {
-			case ES11:
-				pr_info("Device \"R-Car V3H Ver1.1\"\r\n");
-				fallthrough;
-			case ES20:
-				pr_info("Device \"R-Car V3H Ver2.0\"\r\n");
-				fallthrough;
-			default:
-				master_id_max = MASTER_ID_MAX_V3H;
-				break;
-			}
-		} else if (device == R_CAR_V3M) {
-			switch (device_version) {
-			case ES20:
-				pr_info("Device \"R-Car V3M Ver2.0\"\r\n");
-				fallthrough;
-			default:
-				master_id_max = MASTER_ID_MAX_V3M;
-				break;
-			}
-		} else if (device == R_CAR_V4H) {
-			switch (device_version) {
-			case ES10:
-				pr_info("Device \"R-Car V4H Ver1.0\"\r\n");
-				fallthrough;
-			case ES20:
-				pr_info("Device \"R-Car V4H Ver2.0\"\r\n");
-				fallthrough;
-			case ES21:
-				pr_info("Device \"R-Car V4H Ver2.1\"\r\n");
-				fallthrough;
-			default:
-				master_id_max = MASTER_ID_MAX_V4H;
-				break;
-			}
-		} else if (device == R_CAR_S4) {
-			s4n_identifier_reg = ioremap(S4N_IDENTIFIER, sizeof(uint32_t));
-			s4n_identifier = readl(s4n_identifier_reg) & 0x00000001;
-			iounmap((void *)s4n_identifier_reg);
-			if (s4n_identifier)
-				switch (device_version) {
-				case ES10:
-					pr_info("Device \"R-Car S4N Ver1.0\"\r\n");
-					fallthrough;
-				case ES11:
-					pr_info("Device \"R-Car S4N Ver1.1\"\r\n");
-					fallthrough;
-				case ES12:
-					pr_info("Device \"R-Car S4N Ver1.2\"\r\n");
-					fallthrough;
-				default:
-					master_id_max = MASTER_ID_MAX_S4;
-					break;
-				}
-			else
-				switch (device_version) {
-				case ES10:
-					pr_info("Device \"R-Car S4 Ver1.0\"\r\n");
-					fallthrough;
-				case ES11:
-					pr_info("Device \"R-Car S4 Ver1.1\"\r\n");
-					fallthrough;
-				case ES12:
-					pr_info("Device \"R-Car S4 Ver1.2\"\r\n");
-					fallthrough;
-				default:
-					master_id_max = MASTER_ID_MAX_S4;
-					break;
-				}
-		} else if (device == R_CAR_V4M) {
-			switch (device_version) {
-			case ES10:
-				pr_info("Device \"R-Car V4M Ver1.0\"\r\n");
-				fallthrough;
-			default:
-				master_id_max = MASTER_ID_MAX_V4M;
-				break;
-			}
+		soc = qos_soc_lookup(device, device_version);
+		if (soc) {
+			pr_info("Device \"%s\" cut[0x%02x]\r\n", soc->name,
+				device_version);
+			master_id_max = soc->master_id_max;
+			support_exe_membank = soc->exe_membank;
+			bank_xfer = soc->xfer;
 		}
 
+#ifdef QOS_SOC_MASTER_ID_MAX
+		/* A single-SoC build only runs on the SoC it was built for */
+		if (master_id_max != QOS_SOC_MASTER_ID_MAX)
+			master_id_max = 0;
+#endif
+
 		if (master_id_max == 0) {
 			device = 0;
 			device_version = 0;
@@ -310,6 +361,36 @@ int rcar_qos_init(void)
 		}
 		QOS_DBG("Number of master id[%u]", master_id_max);
 
+		if (!ret) {
+			qos_shadow = kcalloc(QOS_SHADOW_TYPE_NUM * QOS_BANK_NUM
+						* QOS_MASTER_NUM,
+					sizeof(*qos_shadow), GFP_KERNEL);
+			qos_entry_gen = kcalloc(QOS_SHADOW_TYPE_NUM
+						* QOS_MASTER_NUM,
+					sizeof(*qos_entry_gen), GFP_KERNEL);
+			if (!qos_shadow || !qos_entry_gen) {
+				pr_err("%s: failed to allocate shadow bank\n",
+					__func__);
+				kfree(qos_shadow);
+				kfree(qos_entry_gen);
+				qos_shadow = NULL;
+				qos_entry_gen = NULL;
+				ret = -ENOMEM;
+			}
+		}
+
+		if (!ret) {
+			if (support_exe_membank)
+				exe_membank_bk = (READ_REG32(qos_reg_base
+						+ QOSCTRL_MEMBANK)
+						& EXE_MEMBANK_MASK) >> 8;
+		}
+
+		hrtimer_init(&qos_switch_timer, CLOCK_MONOTONIC,
+			     HRTIMER_MODE_REL);
+		qos_switch_timer.function = qos_switch_timer_fn;
+		INIT_WORK(&qos_switch_work, qos_switch_work_fn);
+
 		init = 1;
 	}
 
@@ -321,14 +402,50 @@ int rcar_qos_init(void)
 
 }
 
+/*
+ * Adopt the tables left by the bootloader or a previous kernel: read back
+ * every bank into the shadow, so that later updates only write what
+ * differs. exe_membank_bk was already read by rcar_qos_init().
+ */
+void rcar_qos_attach(void)
+{
+	int type;
+	__u32 bank;
+
+	QOS_DBG("begin");
+
+	qos_mutex_lock();
+
+	if (init && qos_shadow) {
+		for (type = QOS_TYPE_FIX; type <= QOS_TYPE_BE; type++)
+			for (bank = 0; bank < QOS_BANK_NUM; bank++)
+				qos_bank_sync(type, bank);
+	}
+
+	mutex_unlock(&qos_mutex);
+
+	QOS_DBG("end");
+}
+
 void rcar_qos_exit(void)
 {
 
 	QOS_DBG("begin");
 
-	mutex_lock(&qos_mutex);
+	qos_mutex_lock();
 
 	if (init) {
+		qos_switch_cancel();
+		qos_switch_settle();
+		hrtimer_cancel(&qos_switch_timer);
+
+		write_seqlock(&qos_shadow_lock);
+		kfree(qos_shadow);
+		qos_shadow = NULL;
+		kfree(qos_entry_gen);
+		qos_entry_gen = NULL;
+		memset(qos_shadow_valid, 0, sizeof(qos_shadow_valid));
+		write_sequnlock(&qos_shadow_lock);
 
 		device = 0;
 		device_version = 0;
@@ -338,111 +455,592 @@ void rcar_qos_exit(void)
 
 	mutex_unlock(&qos_mutex);
 
+	cancel_work_sync(&qos_switch_work);
+
 	QOS_DBG("end");
 }
 
 int rcar_qos_set_all_qos(struct qos_ioc_set_all_qos_param *param)
 {
-	__u32 qos_fix_offset = 0x00000000;
-	__u32 qos_be_offset = 0x00000000;
+	return rcar_qos_set_qos_table((const __u64 *)param->fix_qos,
+				      (const __u64 *)param->be_qos,
+				      QOS_MASTER_NUM);
+}
+
+/* Must be called with qos_mutex held */
+static __u32 qos_get_exe_membank(__u32 *memory_bank)
+{
+	*memory_bank = READ_REG32(qos_reg_base + QOSCTRL_MEMBANK);
+	QOS_DBG("Read Reg[QOS_REG_TYPE_MEMORY_BANK][0x%08x], value[0x%08x]",
+					(qos_base + QOSCTRL_MEMBANK), *memory_bank);
+
+	if (!support_exe_membank)
+		return exe_membank_bk;
+
+	return (*memory_bank & EXE_MEMBANK_MASK) >> 8;
+}
+
+/* Must be called with qos_mutex held */
+static void qos_bank_stage(__u32 exe_membank, const __u64 *fix_qos,
+			   const __u64 *be_qos, int num)
+{
+	__u64 start = qos_stats_ns();
+	int count;
+
+	QOS_DBG("QoS Fix Offset[0x%08x]",
+		QOS_TYPE_BANK_OFF(QOS_TYPE_FIX, exe_membank ^ 0x00000001));
+	QOS_DBG("QoS BE  Offset[0x%08x]",
+		QOS_TYPE_BANK_OFF(QOS_TYPE_BE, exe_membank ^ 0x00000001));
+
+	/* Only the entries that differ from the staged ones reach the bus */
+	if (fix_qos) {
+		count = qos_bank_update(QOS_TYPE_FIX, exe_membank ^ 0x00000001,
+					fix_qos, num);
+		trace_qos_bank_stage(QOS_TYPE_FIX, exe_membank ^ 0x00000001,
+				     num, count);
+	}
+	if (be_qos) {
+		count = qos_bank_update(QOS_TYPE_BE, exe_membank ^ 0x00000001,
+					be_qos, num);
+		trace_qos_bank_stage(QOS_TYPE_BE, exe_membank ^ 0x00000001,
+				     num, count);
+	}
+	standby_staged = true;
+
+	qos_stats_hist(QOS_HIST_STAGE_NS, qos_stats_ns() - start);
+}
+
+/*
+ * Reset the standby bank to the tables executing from @exe_membank, dropping
+ * whatever else was staged so it does not ride along with the next switch.
+ * Must be called with qos_mutex held.
+ */
+static void qos_bank_restage(__u32 exe_membank)
+{
+	qos_bank_sync(QOS_TYPE_FIX, exe_membank);
+	qos_bank_sync(QOS_TYPE_BE, exe_membank);
+	qos_bank_stage(exe_membank, QOS_SHADOW(QOS_TYPE_FIX, exe_membank),
+		       QOS_SHADOW(QOS_TYPE_BE, exe_membank), QOS_MASTER_NUM);
+	standby_staged = false;
+}
+
+/* Stamp the entries that differ between the old and new executing bank */
+static void qos_entry_gen_stamp(__u32 exe_membank)
+{
+	__u64 *old;
+	__u64 *new;
+	__u64 *gen;
+	bool valid;
+	int type, i;
+
+	write_seqlock(&qos_shadow_lock);
+	qos_commit_gen++;
+	for (type = 0; type < QOS_SHADOW_TYPE_NUM; type++) {
+		old = QOS_SHADOW(type, exe_membank ^ 0x00000001);
+		new = QOS_SHADOW(type, exe_membank);
+		gen = QOS_ENTRY_GEN(type);
+		valid = qos_shadow_valid[type][exe_membank ^ 0x00000001];
+		for (i = 0; i < QOS_MASTER_NUM; i++) {
+			if (!valid || (old[i] != new[i]))
+				gen[i] = qos_commit_gen;
+		}
+	}
+	write_sequnlock(&qos_shadow_lock);
+}
+
+/* Bring the standby bank in line with @exe_membank, now executing */
+static void qos_bank_resync(__u32 exe_membank)
+{
+	int count;
+
+	qos_entry_gen_stamp(exe_membank);
+
+	count = qos_bank_update(QOS_TYPE_FIX, exe_membank ^ 0x00000001,
+				QOS_SHADOW(QOS_TYPE_FIX, exe_membank),
+				QOS_MASTER_NUM);
+	trace_qos_bank_resync(QOS_TYPE_FIX, exe_membank ^ 0x00000001,
+			      QOS_MASTER_NUM, count);
+
+	count = qos_bank_update(QOS_TYPE_BE, exe_membank ^ 0x00000001,
+				QOS_SHADOW(QOS_TYPE_BE, exe_membank),
+				QOS_MASTER_NUM);
+	trace_qos_bank_resync(QOS_TYPE_BE, exe_membank ^ 0x00000001,
+			      QOS_MASTER_NUM, count);
+
+	standby_staged = false;
+}
+
+/* Must be called with qos_mutex held */
+static int qos_bank_switch(__u32 memory_bank, __u32 exe_membank)
+{
+	__u32 value = 0x00000000;
+
+	/* The standby bank only has to be read back if it was never staged */
+	qos_bank_sync(QOS_TYPE_FIX, exe_membank ^ 0x00000001);
+	qos_bank_sync(QOS_TYPE_BE, exe_membank ^ 0x00000001);
+
+	value |= memory_bank & 0xFFFFFFFE;
+	value |= (exe_membank ^ 0x00000001) & 0x00000001;
+
+	if (rcar_qos_wait_switching(value))
+		return -ETIMEDOUT;
+
+	write_seqlock(&qos_shadow_lock);
+	exe_membank_bk = (exe_membank ^ 0x00000001) & 0x00000001;
+	write_sequnlock(&qos_shadow_lock);
+
+	qos_bank_resync(exe_membank ^ 0x00000001);
+
+	return 0;
+}
+
+/*
+ * Stage the first @num entries of the FIX and/or BE table into the standby
+ * bank. A NULL table is left untouched.
+ */
+int rcar_qos_set_qos_table(const __u64 *fix_qos, const __u64 *be_qos, int num)
+{
+	__u32 memory_bank;
 	__u32 exe_membank;
-	int i;
+	int ret;
 
 	QOS_DBG("begin");
 
-	mutex_lock(&qos_mutex);
+	if ((num <= 0) || (num > QOS_MASTER_NUM))
+		return -EINVAL;
 
-	if (!support_exe_membank) {
-		exe_membank = exe_membank_bk;
-	} else {
-		QOS_DBG("Read Reg[QOS_REG_TYPE_MEMORY_BANK][0x%08x], value[0x%08x]",
-						(qos_base + QOSCTRL_MEMBANK),
-						READ_REG32(qos_reg_base + QOSCTRL_MEMBANK));
+	qos_mutex_lock();
 
-		exe_membank = (READ_REG32(qos_reg_base + QOSCTRL_MEMBANK)
-						& EXE_MEMBANK_MASK) >> 8;
+	ret = qos_switch_settle();
+	if (!ret) {
+		exe_membank = qos_get_exe_membank(&memory_bank);
+		qos_bank_stage(exe_membank, fix_qos, be_qos, num);
 	}
 
-	qos_fix_offset |= (QOS_TYPE_FIX << 13) & 0x0000E000;
-	qos_fix_offset |= ((exe_membank ^ 0x00000001) << 12) & 0x00001000;
+	mutex_unlock(&qos_mutex);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+/*
+ * Stage the tables as rcar_qos_set_qos_table() does and switch to them in
+ * the same critical section, so no other client can flip a half-staged
+ * bank in between. The executing bank after the call is returned in
+ * @exe_membank.
+ */
+int rcar_qos_commit_qos_table(const __u64 *fix_qos, const __u64 *be_qos,
+			      int num, __u8 *exe_membank)
+{
+	__u32 memory_bank;
+	__u32 cur_membank;
+	int ret;
 
-	qos_be_offset |= (QOS_TYPE_BE << 13) & 0x0000E000;
-	qos_be_offset |= ((exe_membank ^ 0x00000001) << 12) & 0x00001000;
+	QOS_DBG("begin");
 
-	QOS_DBG("QoS Fix Offset[0x%08x]", qos_fix_offset);
-	QOS_DBG("QoS BE  Offset[0x%08x]", qos_be_offset);
+	if ((num <= 0) || (num > QOS_MASTER_NUM))
+		return -EINVAL;
 
-	for (i = 0; i < master_id_max + 1; i++)
-		qos_reg_load(param->fix_qos, qos_fix_offset, i);
+	qos_mutex_lock();
 
-	for (i = 0; i < master_id_max + 1; i++)
-		qos_reg_load(param->be_qos, qos_be_offset, i);
+	ret = qos_switch_settle();
+	if (!ret) {
+		cur_membank = qos_get_exe_membank(&memory_bank);
+		qos_bank_stage(cur_membank, fix_qos, be_qos, num);
+		ret = qos_bank_switch(memory_bank, cur_membank);
+	}
+	*exe_membank = exe_membank_bk;
 
 	mutex_unlock(&qos_mutex);
 
 	QOS_DBG("end");
 
+	return ret;
+}
+
+static int qos_check_ip_qos(const struct qos_ioc_set_ip_qos_param *ip_qos,
+			    __u32 num)
+{
+	__u32 i;
+
+	for (i = 0; i < num; i++) {
+		if ((ip_qos[i].qos_type >= QOS_SHADOW_TYPE_NUM) ||
+		    (ip_qos[i].master_id >= QOS_MASTER_NUM)) {
+			pr_err("%s: invalid entry[%u] type[%u] master id[%u]\n",
+				__func__, i, ip_qos[i].qos_type,
+				ip_qos[i].master_id);
+			return -EINVAL;
+		}
+	}
+
 	return 0;
 }
 
+static void qos_ip_qos_stage(__u32 exe_membank,
+			     const struct qos_ioc_set_ip_qos_param *ip_qos,
+			     const __u64 *mask, __u32 num)
+{
+	__u64 start = qos_stats_ns();
+	__u64 *shadow;
+	__u64 value;
+	__u32 i;
+
+	/* Masked updates are merged into the current standby contents */
+	qos_bank_sync(QOS_TYPE_FIX, exe_membank ^ 0x00000001);
+	qos_bank_sync(QOS_TYPE_BE, exe_membank ^ 0x00000001);
+
+	for (i = 0; i < num; i++) {
+		shadow = QOS_SHADOW(ip_qos[i].qos_type, exe_membank ^ 0x00000001);
+		value = ip_qos[i].qos;
+		if (mask)
+			value = (shadow[ip_qos[i].master_id] & ~mask[i])
+						| (value & mask[i]);
+
+		qos_entry_update(ip_qos[i].qos_type, exe_membank ^ 0x00000001,
+				 ip_qos[i].master_id, value);
+	}
+	standby_staged = true;
+
+	qos_stats_hist(QOS_HIST_STAGE_NS, qos_stats_ns() - start);
+}
+
+int rcar_qos_set_ip_qos(const struct qos_ioc_set_ip_qos_param *ip_qos,
+			const __u64 *mask, __u32 num)
+{
+	__u32 memory_bank;
+	__u32 exe_membank;
+	int ret;
+
+	QOS_DBG("begin");
+
+	ret = qos_check_ip_qos(ip_qos, num);
+	if (ret)
+		return ret;
+
+	qos_mutex_lock();
+
+	ret = qos_switch_settle();
+	if (ret)
+		goto err_i1;
+
+	exe_membank = qos_get_exe_membank(&memory_bank);
+	qos_ip_qos_stage(exe_membank, ip_qos, mask, num);
+
+err_i1:
+	mutex_unlock(&qos_mutex);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+/*
+ * Stage entries as rcar_qos_set_ip_qos() does and switch to them in the
+ * same critical section. The executing bank after the call is returned in
+ * @exe_membank.
+ */
+int rcar_qos_commit_ip_qos(const struct qos_ioc_set_ip_qos_param *ip_qos,
+			   const __u64 *mask, __u32 num, __u8 *exe_membank)
+{
+	__u32 memory_bank;
+	__u32 cur_membank;
+	int ret;
+
+	QOS_DBG("begin");
+
+	ret = qos_check_ip_qos(ip_qos, num);
+	if (ret)
+		return ret;
+
+	qos_mutex_lock();
+
+	ret = qos_switch_settle();
+	if (!ret) {
+		cur_membank = qos_get_exe_membank(&memory_bank);
+		qos_ip_qos_stage(cur_membank, ip_qos, mask, num);
+		ret = qos_bank_switch(memory_bank, cur_membank);
+	}
+	*exe_membank = exe_membank_bk;
+
+	mutex_unlock(&qos_mutex);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+/*
+ * Merge entries into the executing tables and switch to the result. Unlike
+ * rcar_qos_commit_ip_qos(), the standby bank is first reset to the executing
+ * tables, so it fails with -EBUSY rather than drop entries another client
+ * has staged and not yet switched to. An empty set changes nothing. Used by
+ * the in-kernel committers, which derive their entries from the executing
+ * bank. The executing bank after the call is returned in @exe_membank.
+ */
+int rcar_qos_apply_ip_qos(const struct qos_ioc_set_ip_qos_param *ip_qos,
+			  const __u64 *mask, __u32 num, __u8 *exe_membank)
+{
+	__u32 memory_bank;
+	__u32 cur_membank;
+	int ret;
+
+	QOS_DBG("begin");
+
+	ret = qos_check_ip_qos(ip_qos, num);
+	if (ret)
+		return ret;
+
+	qos_mutex_lock();
+
+	if (num == 0)
+		goto err_i1;
+
+	ret = qos_switch_settle();
+	if (ret)
+		goto err_i1;
+
+	if (standby_staged) {
+		ret = -EBUSY;
+		goto err_i1;
+	}
+
+	cur_membank = qos_get_exe_membank(&memory_bank);
+	qos_bank_restage(cur_membank);
+	qos_ip_qos_stage(cur_membank, ip_qos, mask, num);
+	ret = qos_bank_switch(memory_bank, cur_membank);
+
+err_i1:
+	*exe_membank = exe_membank_bk;
+
+	mutex_unlock(&qos_mutex);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+__u64 rcar_qos_get_commit_gen(void)
+{
+	unsigned int seq;
+	__u64 gen;
+
+	do {
+		seq = read_seqbegin(&qos_shadow_lock);
+		gen = qos_commit_gen;
+	} while (read_seqretry(&qos_shadow_lock, seq));
+
+	return gen;
+}
+
+/*
+ * Commit a transaction begun at generation @since_gen: the standby bank is
+ * reset to the executing tables, the transaction's entries are merged in
+ * under their masks and the banks are switched, so exactly the executing
+ * state plus the transaction goes live. Entries changed by a switch after
+ * @since_gen are counted in @conflicts; unless @merge is set, any conflict
+ * rejects the whole transaction with -EAGAIN. Otherwise the masked bits are
+ * applied on top of the newer values. Entries another client has staged but
+ * not yet switched to would be dropped by the reset, so the commit fails
+ * with -EBUSY instead while there are any. An empty transaction changes
+ * nothing and returns without touching the banks.
+ */
+int rcar_qos_commit_txn(const struct qos_ioc_set_ip_qos_param *ip_qos,
+			const __u64 *mask, __u32 num, __u64 since_gen,
+			bool merge, __u32 *conflicts, __u8 *exe_membank)
+{
+	__u32 memory_bank;
+	__u32 cur_membank;
+	__u32 i;
+	int ret;
+
+	QOS_DBG("begin");
+
+	ret = qos_check_ip_qos(ip_qos, num);
+	if (ret)
+		return ret;
+
+	*conflicts = 0;
+
+	qos_mutex_lock();
+
+	if (num == 0)
+		goto err_i1;
+
+	ret = qos_switch_settle();
+	if (ret)
+		goto err_i1;
+
+	if (standby_staged) {
+		ret = -EBUSY;
+		goto err_i1;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (QOS_ENTRY_GEN(ip_qos[i].qos_type)[ip_qos[i].master_id]
+								> since_gen)
+			(*conflicts)++;
+	}
+	if (*conflicts && !merge) {
+		ret = -EAGAIN;
+		goto err_i1;
+	}
+
+	cur_membank = qos_get_exe_membank(&memory_bank);
+	qos_bank_restage(cur_membank);
+	qos_ip_qos_stage(cur_membank, ip_qos, mask, num);
+	ret = qos_bank_switch(memory_bank, cur_membank);
+
+err_i1:
+	*exe_membank = exe_membank_bk;
+
+	mutex_unlock(&qos_mutex);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+/*
+ * Synchronous switches are coalesced: every caller draws a ticket before
+ * queueing on qos_mutex, and a switch started after a caller's ticket was
+ * drawn covers it, since that caller's staging was already done. Callers
+ * covered by a switch that finished while they waited return its result
+ * without touching the hardware.
+ */
 int rcar_qos_switch_membank(void)
 {
+	__u64 ticket = atomic64_inc_return(&switch_req_ticket);
 	__u32 memory_bank;
-	__u32 qos_fix_offset = 0x00000000;
-	__u32 qos_be_offset = 0x00000000;
 	__u32 exe_membank;
-	__u32 value = 0x00000000;
-	int i;
+	__u64 covered;
 	int ret = 0;
 
 	QOS_DBG("begin");
 
-	mutex_lock(&qos_mutex);
+	qos_mutex_lock();
 
-	memory_bank = READ_REG32(qos_reg_base + QOSCTRL_MEMBANK);
-	QOS_DBG("Read Reg[QOS_REG_TYPE_MEMORY_BANK][0x%08x], value[0x%08x]",
-					(qos_base + QOSCTRL_MEMBANK), memory_bank);
+	if (switch_sync_done_ticket >= ticket) {
+		qos_stats_inc(QOS_STAT_SWITCH_COALESCED);
+		ret = switch_sync_result;
+		goto err_i1;
+	}
 
-	if (!support_exe_membank)
-		exe_membank = exe_membank_bk;
-	else
-		exe_membank = (memory_bank & EXE_MEMBANK_MASK) >> 8;
+	ret = qos_switch_settle();
+	if (!ret) {
+		covered = atomic64_read(&switch_req_ticket);
+		exe_membank = qos_get_exe_membank(&memory_bank);
+		ret = qos_bank_switch(memory_bank, exe_membank);
+		switch_sync_done_ticket = covered;
+		switch_sync_result = ret;
+	}
+
+err_i1:
+	mutex_unlock(&qos_mutex);
 
-	qos_fix_offset |= (QOS_TYPE_FIX << 13) & 0x0000E000;
-	qos_fix_offset |= ((exe_membank ^ 0x00000001) << 12) & 0x00001000;
+	QOS_DBG("end");
+
+	return ret;
+}
 
-	qos_be_offset |= (QOS_TYPE_BE << 13) & 0x0000E000;
-	qos_be_offset |= ((exe_membank ^ 0x00000001) << 12) & 0x00001000;
+/*
+ * Record a switch to the standby bank in state @state. Must be called with
+ * qos_mutex held and no switch in flight.
+ */
+static void qos_switch_prepare(int state, __u64 *seq)
+{
+	__u32 memory_bank;
+	__u32 exe_membank;
+	__u32 value = 0x00000000;
+	unsigned long flags;
 
-	for (i = 0; i < master_id_max + 1; i++)
-		qos_reg_store(fix_qos_buf, qos_fix_offset, i);
+	exe_membank = qos_get_exe_membank(&memory_bank);
 
-	for (i = 0; i < master_id_max + 1; i++)
-		qos_reg_store(be_qos_buf, qos_be_offset, i);
+	/* The timer writes the register, so the standby bank is known here */
+	qos_bank_sync(QOS_TYPE_FIX, exe_membank ^ 0x00000001);
+	qos_bank_sync(QOS_TYPE_BE, exe_membank ^ 0x00000001);
 
 	value |= memory_bank & 0xFFFFFFFE;
 	value |= (exe_membank ^ 0x00000001) & 0x00000001;
 
-	if (rcar_qos_wait_switching(value)) {
-		ret = -ETIMEDOUT;
+	write_seqlock_irqsave(&qos_switch_lock, flags);
+	switch_state = state;
+	switch_retry = WAIT_RETRY_COUNT;
+	switch_value = value;
+	switch_target = value & 0x00000001;
+	switch_deadline_ns = 0;
+	switch_kick_ns = 0;
+	switch_done_ns = 0;
+	*seq = ++switch_seq;
+	write_sequnlock_irqrestore(&qos_switch_lock, flags);
+}
+
+static ktime_t qos_switch_poll_interval(void)
+{
+	return ns_to_ktime((support_exe_membank ?
+			    WAIT_SWITCH_BANK_US : WAIT_SWITCH_BANK_US_MIN)
+			   * NSEC_PER_USEC);
+}
+
+/*
+ * Write QOSCTRL_MEMBANK and return without waiting for the switch. The
+ * returned sequence number is reported in switch_done_seq once the switch
+ * has completed or timed out.
+ */
+int rcar_qos_switch_membank_async(__u64 *seq)
+{
+	int ret;
+
+	QOS_DBG("begin");
+
+	qos_mutex_lock();
+
+	ret = qos_switch_settle();
+	if (ret)
 		goto err_i1;
-	}
 
-	exe_membank_bk = (exe_membank ^ 0x00000001) & 0x00000001;
+	qos_switch_prepare(QOS_SWITCH_PENDING, seq);
+
+	QOS_DBG("Write Reg[QOS_REG_TYPE_MEMORY_BANK][0x%08x], value[0x%08x]",
+				(qos_base + QOSCTRL_MEMBANK), switch_value);
+	switch_kick_ns = ktime_get_ns();
+	trace_qos_membank_write(switch_value);
+	qos_stats_inc(QOS_STAT_SWITCH);
+	WRITE_REG32(switch_value, qos_reg_base + QOSCTRL_MEMBANK);
 
-	qos_fix_offset = 0x00000000;
-	qos_fix_offset |= (QOS_TYPE_FIX << 13) & 0x0000E000;
-	qos_fix_offset |= (exe_membank << 12) & 0x00001000;
+	hrtimer_start(&qos_switch_timer, qos_switch_poll_interval(),
+		      HRTIMER_MODE_REL);
 
-	qos_be_offset = 0x00000000;
-	qos_be_offset |= (QOS_TYPE_BE << 13) & 0x0000E000;
-	qos_be_offset |= (exe_membank << 12) & 0x00001000;
+err_i1:
+	mutex_unlock(&qos_mutex);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+/*
+ * Arm a switch to the standby bank at the CLOCK_MONOTONIC time @deadline_ns.
+ * The register write is issued from qos_switch_timer, so the standby bank
+ * cannot be staged until the switch has fired or been cancelled.
+ */
+int rcar_qos_schedule_switch(__u64 deadline_ns, __u64 *seq)
+{
+	int ret;
+
+	QOS_DBG("begin");
+
+	qos_mutex_lock();
+
+	ret = qos_switch_settle();
+	if (ret)
+		goto err_i1;
 
-	for (i = 0; i < master_id_max + 1; i++)
-		qos_reg_load(fix_qos_buf, qos_fix_offset, i);
+	qos_switch_prepare(QOS_SWITCH_ARMED, seq);
+	switch_deadline_ns = deadline_ns;
 
-	for (i = 0; i < master_id_max + 1; i++)
-		qos_reg_load(be_qos_buf, qos_be_offset, i);
+	hrtimer_start(&qos_switch_timer, ns_to_ktime(deadline_ns),
+		      HRTIMER_MODE_ABS);
 
 err_i1:
 	mutex_unlock(&qos_mutex);
@@ -452,121 +1050,622 @@ err_i1:
 	return ret;
 }
 
-static void qos_sram_backup(__u32 qos_fix_offset, __u32 qos_be_offset)
+int rcar_qos_cancel_switch(void)
 {
-	int i;
+	int ret;
+
+	QOS_DBG("begin");
+
+	qos_mutex_lock();
+	ret = qos_switch_cancel();
+	mutex_unlock(&qos_mutex);
+
+	QOS_DBG("end");
 
-	for (i = 0; i < master_id_max + 1; i++)
-		qos_reg_store(backup_bank + qos_fix_offset, qos_fix_offset, i);
+	return ret;
+}
+
+int rcar_qos_get_switch_status(struct qos_ioc_switch_status_param *param)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&qos_switch_lock);
+		param->seq = switch_done_seq;
+		param->deadline_ns = switch_deadline_ns;
+		param->kick_ns = switch_kick_ns;
+		param->done_ns = switch_done_ns;
+		param->result = switch_result;
+		if (switch_state == QOS_SWITCH_IDLE)
+			param->state = QOS_SWITCH_STATE_IDLE;
+		else if (switch_state == QOS_SWITCH_ARMED)
+			param->state = QOS_SWITCH_STATE_ARMED;
+		else
+			param->state = QOS_SWITCH_STATE_PENDING;
+	} while (read_seqretry(&qos_switch_lock, seq));
+
+	do {
+		seq = read_seqbegin(&qos_shadow_lock);
+		param->exe_membank = exe_membank_bk;
+	} while (read_seqretry(&qos_shadow_lock, seq));
 
-	for (i = 0; i < master_id_max + 1; i++)
-		qos_reg_store(backup_bank + qos_be_offset, qos_be_offset, i);
+	return 0;
 }
 
-void rcar_qos_suspend(void)
+__u64 rcar_qos_get_switch_done_seq(void)
 {
-	__u32 exe_membank;
-	__u32 qos_fix_offset = 0x00000000;
-	__u32 qos_be_offset = 0x00000000;
+	unsigned int seq;
+	__u64 done_seq;
+
+	do {
+		seq = read_seqbegin(&qos_switch_lock);
+		done_seq = switch_done_seq;
+	} while (read_seqretry(&qos_switch_lock, seq));
+
+	return done_seq;
+}
+
+wait_queue_head_t *rcar_qos_get_switch_wq(void)
+{
+	return &qos_switch_wq;
+}
+
+void rcar_qos_register_switch_notifier(struct qos_switch_notifier *nb)
+{
+	qos_mutex_lock();
+	list_add_tail(&nb->list, &qos_switch_notifiers);
+	mutex_unlock(&qos_mutex);
+}
+
+void rcar_qos_unregister_switch_notifier(struct qos_switch_notifier *nb)
+{
+	qos_mutex_lock();
+	list_del(&nb->list);
+	mutex_unlock(&qos_mutex);
+}
+
+static enum hrtimer_restart qos_switch_timer_fn(struct hrtimer *timer)
+{
+	__u32 memory_bank;
+	int result = 0;
+	unsigned long flags;
+
+	write_seqlock_irqsave(&qos_switch_lock, flags);
+	switch (switch_state) {
+	case QOS_SWITCH_ARMED:
+		/* Deadline of a scheduled switch reached */
+		switch_kick_ns = ktime_get_ns();
+		trace_qos_membank_write(switch_value);
+		qos_stats_inc(QOS_STAT_SWITCH);
+		WRITE_REG32(switch_value, qos_reg_base + QOSCTRL_MEMBANK);
+		switch_state = QOS_SWITCH_PENDING;
+		write_sequnlock_irqrestore(&qos_switch_lock, flags);
+		hrtimer_forward_now(timer, qos_switch_poll_interval());
+		return HRTIMER_RESTART;
+	case QOS_SWITCH_PENDING:
+		break;
+	default:
+		/* Cancelled while the timer was firing */
+		write_sequnlock_irqrestore(&qos_switch_lock, flags);
+		return HRTIMER_NORESTART;
+	}
+	write_sequnlock_irqrestore(&qos_switch_lock, flags);
+
+	if (support_exe_membank) {
+		memory_bank = READ_REG32(qos_reg_base + QOSCTRL_MEMBANK);
+		trace_qos_switch_poll(memory_bank, switch_retry);
+		if (((memory_bank & EXE_MEMBANK_MASK) >> 8) != switch_target) {
+			if (--switch_retry > 0) {
+				hrtimer_forward_now(timer,
+						    qos_switch_poll_interval());
+				return HRTIMER_RESTART;
+			}
+			result = -ETIMEDOUT;
+			qos_stats_inc(QOS_STAT_SWITCH_TIMEOUT);
+		}
+		qos_stats_hist(QOS_HIST_SWITCH_POLL,
+			       WAIT_RETRY_COUNT - max(switch_retry, 1) + 1);
+	}
+
+	write_seqlock_irqsave(&qos_switch_lock, flags);
+	switch_state = QOS_SWITCH_DONE;
+	switch_result = result;
+	switch_done_ns = ktime_get_ns();
+	write_sequnlock_irqrestore(&qos_switch_lock, flags);
+
+	wake_up_all(&qos_switch_wq);
+	schedule_work(&qos_switch_work);
+
+	return HRTIMER_NORESTART;
+}
+
+/* Must be called with qos_mutex held */
+static void qos_switch_notify(void)
+{
+	struct qos_switch_notifier *nb;
+
+	wake_up_all(&qos_switch_wq);
+	list_for_each_entry(nb, &qos_switch_notifiers, list)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+		eventfd_signal(nb->eventfd);
+#else
+		eventfd_signal(nb->eventfd, 1);
+#endif
+}
+
+/* Must be called with qos_mutex held */
+static void qos_switch_finish(void)
+{
+	unsigned long flags;
+	__u32 target;
+	int result;
+
+	write_seqlock_irqsave(&qos_switch_lock, flags);
+	if (switch_state != QOS_SWITCH_DONE) {
+		write_sequnlock_irqrestore(&qos_switch_lock, flags);
+		return;
+	}
+	target = switch_target;
+	result = switch_result;
+	trace_qos_switch_done(switch_seq, result, switch_kick_ns, switch_done_ns);
+	qos_stats_hist(QOS_HIST_SWITCH_NS, switch_done_ns - switch_kick_ns);
+	write_sequnlock_irqrestore(&qos_switch_lock, flags);
+
+	if (result) {
+		pr_err("rcar_qos_switch_membank_async: timeout switch membank[errno=%d]\n",
+			result);
+	} else {
+		write_seqlock(&qos_shadow_lock);
+		exe_membank_bk = target;
+		write_sequnlock(&qos_shadow_lock);
+
+		qos_bank_resync(target);
+	}
+
+	write_seqlock_irqsave(&qos_switch_lock, flags);
+	switch_state = QOS_SWITCH_IDLE;
+	switch_done_seq = switch_seq;
+	write_sequnlock_irqrestore(&qos_switch_lock, flags);
+
+	qos_switch_notify();
+}
+
+/*
+ * Wait for an asynchronous switch still in flight and finish it, so the
+ * caller sees a settled exe_membank. Returns -EBUSY while a scheduled
+ * switch is armed. Must be called with qos_mutex held.
+ */
+static int qos_switch_settle(void)
+{
+	if (READ_ONCE(switch_state) == QOS_SWITCH_ARMED)
+		return -EBUSY;
 
-	exe_membank = 0;
-	qos_fix_offset |= (QOS_TYPE_FIX << 13) & 0x0000E000;
-	qos_fix_offset |= (exe_membank << 12) & 0x00001000;
+	wait_event(qos_switch_wq, READ_ONCE(switch_state) != QOS_SWITCH_PENDING);
+	qos_switch_finish();
 
-	qos_be_offset = 0x00000000;
-	qos_be_offset |= (QOS_TYPE_BE << 13) & 0x0000E000;
-	qos_be_offset |= (exe_membank << 12) & 0x00001000;
+	return 0;
+}
+
+/*
+ * Cancel an armed scheduled switch. Returns -EALREADY if it has already
+ * written QOSCTRL_MEMBANK. Must be called with qos_mutex held.
+ */
+static int qos_switch_cancel(void)
+{
+	unsigned long flags;
+
+	write_seqlock_irqsave(&qos_switch_lock, flags);
+	if (switch_state != QOS_SWITCH_ARMED) {
+		write_sequnlock_irqrestore(&qos_switch_lock, flags);
+		return (switch_state == QOS_SWITCH_IDLE) ? -ENOENT : -EALREADY;
+	}
+	switch_state = QOS_SWITCH_IDLE;
+	switch_result = -ECANCELED;
+	switch_done_ns = ktime_get_ns();
+	switch_done_seq = switch_seq;
+	write_sequnlock_irqrestore(&qos_switch_lock, flags);
+
+	hrtimer_try_to_cancel(&qos_switch_timer);
+	qos_switch_notify();
+
+	return 0;
+}
+
+static void qos_switch_work_fn(struct work_struct *work)
+{
+	qos_mutex_lock();
+	qos_switch_finish();
+	mutex_unlock(&qos_mutex);
+}
+
+int rcar_qos_get_master_id_max(void)
+{
+	return master_id_max;
+}
+
+__u32 rcar_qos_get_product(void)
+{
+	return device;
+}
+
+static int qos_resolve_membank(__u8 membank, __u32 *bank)
+{
+	switch (membank) {
+	case 0:
+	case 1:
+		*bank = membank;
+		break;
+	case QOS_MEMBANK_EXE:
+		*bank = exe_membank_bk;
+		break;
+	case QOS_MEMBANK_STANDBY:
+		*bank = exe_membank_bk ^ 0x00000001;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int rcar_qos_get_status(struct qos_ioc_get_status_param *param)
+{
+	__u32 memory_bank;
+	unsigned int seq;
+
+	param->master_id_max = master_id_max;
+	/* No register holding the QoS status enable is documented */
+	param->statqen = 0;
+
+	if (param->flags & QOS_GET_FLAG_HW) {
+		memory_bank = READ_REG32(qos_reg_base + QOSCTRL_MEMBANK);
+		param->exe_membank = support_exe_membank ?
+			(memory_bank & EXE_MEMBANK_MASK) >> 8 : exe_membank_bk;
+		return 0;
+	}
+
+	do {
+		seq = read_seqbegin(&qos_shadow_lock);
+		param->exe_membank = exe_membank_bk;
+	} while (read_seqretry(&qos_shadow_lock, seq));
+
+	return 0;
+}
+
+int rcar_qos_get_ip_qos(struct qos_ioc_get_ip_qos_param *param)
+{
+	unsigned int seq;
+	__u32 bank;
+	bool cached;
+
+	if ((param->qos_type >= QOS_SHADOW_TYPE_NUM) ||
+	    (param->master_id >= QOS_MASTER_NUM))
+		return -EINVAL;
+
+	do {
+		seq = read_seqbegin(&qos_shadow_lock);
+		cached = false;
+		if (qos_resolve_membank(param->membank, &bank))
+			return -EINVAL;
+		if (!(param->flags & QOS_GET_FLAG_HW) &&
+		    qos_shadow_valid[param->qos_type][bank]) {
+			param->qos = QOS_SHADOW(param->qos_type,
+						bank)[param->master_id];
+			cached = true;
+		}
+	} while (read_seqretry(&qos_shadow_lock, seq));
+
+	/* Banks never seen by the driver are served from the hardware */
+	if (!cached)
+		param->qos = READ_REG64(qos_reg_base
+				+ QOS_TYPE_BANK_OFF(param->qos_type, bank)
+				+ QOS_BANK_OFF(param->master_id));
+
+	return 0;
+}
+
+int rcar_qos_get_all_qos(__u64 *fix_qos, __u64 *be_qos,
+			 __u8 membank, __u8 flags)
+{
+	__u64 *dst[QOS_SHADOW_TYPE_NUM] = { fix_qos, be_qos };
+	bool cached[QOS_SHADOW_TYPE_NUM];
+	unsigned int seq;
+	__u32 bank;
+	int type;
+
+	/* A copy torn by a concurrent writer is simply taken again */
+	do {
+		seq = read_seqbegin(&qos_shadow_lock);
+		if (qos_resolve_membank(membank, &bank))
+			return -EINVAL;
+		for (type = 0; type < QOS_SHADOW_TYPE_NUM; type++) {
+			cached[type] = false;
+			if (!(flags & QOS_GET_FLAG_HW) &&
+			    qos_shadow_valid[type][bank]) {
+				memcpy(dst[type], QOS_SHADOW(type, bank),
+				       QOS_MASTER_NUM * sizeof(__u64));
+				cached[type] = true;
+			}
+		}
+	} while (read_seqretry(&qos_shadow_lock, seq));
+
+	for (type = 0; type < QOS_SHADOW_TYPE_NUM; type++) {
+		if (cached[type])
+			continue;
+
+		qos_bank_store(dst[type], QOS_TYPE_BANK_OFF(type, bank),
+			       QOS_MASTER_NUM);
+	}
+
+	return 0;
+}
+
+/*
+ * Suspend and resume work from the shadow. Suspend only reads back the
+ * banks that were never staged since load; resume compares every entry
+ * of each bank with the shadow and reprograms the tables only if the
+ * hardware lost them. Lost SRAM may match the shadow at any few entries,
+ * zeroes against zero values for instance, so no entry is skipped; the
+ * reads still cost less than rewriting the banks.
+ */
+
+/* Must be called with qos_mutex held */
+static void qos_sram_backup(__u32 bank)
+{
+	int num = 0;
+	int type;
+
+	for (type = QOS_TYPE_FIX; type <= QOS_TYPE_BE; type++) {
+		if (!qos_shadow_valid[type][bank]) {
+			qos_bank_sync(type, bank);
+			num += QOS_MASTER_NUM;
+		}
+	}
 
-	qos_sram_backup(qos_fix_offset, qos_be_offset);
+	trace_qos_sram_backup(QOS_TYPE_BANK_OFF(QOS_TYPE_FIX, bank),
+			      QOS_TYPE_BANK_OFF(QOS_TYPE_BE, bank), num);
+}
 
-	qos_fix_offset = 0x00000000;
-	qos_fix_offset |= (QOS_TYPE_FIX << 13) & 0x0000E000;
-	qos_fix_offset |= ((exe_membank ^ 0x00000001) << 12) & 0x00001000;
+void rcar_qos_suspend(void)
+{
+	qos_mutex_lock();
+
+	if (init) {
+		qos_switch_cancel();
+		qos_switch_settle();
 
-	qos_be_offset |= (QOS_TYPE_BE << 13) & 0x0000E000;
-	qos_be_offset |= ((exe_membank ^ 0x00000001) << 12) & 0x00001000;
+		qos_sram_backup(0);
+		qos_sram_backup(1);
+	}
 
-	qos_sram_backup(qos_fix_offset, qos_be_offset);
+	mutex_unlock(&qos_mutex);
 }
 
-static void qos_sram_reload(__u32 qos_fix_offset, __u32 qos_be_offset)
+/* Must be called with qos_mutex held */
+static bool qos_sram_retained(void)
 {
+	__u64 *shadow;
+	__u32 offset;
+	__u32 bank;
+	int type;
 	int i;
 
-	for (i = 0; i < master_id_max + 1; i++)
-		qos_reg_load(backup_bank + qos_fix_offset, qos_fix_offset, i);
+	if (support_exe_membank &&
+	    (((READ_REG32(qos_reg_base + QOSCTRL_MEMBANK) & EXE_MEMBANK_MASK)
+	      >> 8) != exe_membank_bk))
+		return false;
+
+	for (type = QOS_TYPE_FIX; type <= QOS_TYPE_BE; type++) {
+		for (bank = 0; bank < QOS_BANK_NUM; bank++) {
+			shadow = QOS_SHADOW(type, bank);
+			offset = QOS_TYPE_BANK_OFF(type, bank);
+			for (i = 0; i < QOS_MASTER_NUM; i++) {
+				if (READ_REG64(qos_reg_base + offset
+					       + QOS_BANK_OFF(i)) != shadow[i])
+					return false;
+			}
+		}
+	}
 
-	for (i = 0; i < master_id_max + 1; i++)
-		qos_reg_load(backup_bank + qos_be_offset, qos_be_offset, i);
+	return true;
 }
 
-void rcar_qos_resume(void)
+/* Must be called with qos_mutex held */
+static void qos_sram_reload(__u32 bank)
 {
-	__u32 exe_membank;
-	__u32 qos_fix_offset = 0x00000000;
-	__u32 qos_be_offset = 0x00000000;
-	__u32 value = 0x00000000;
+	__u32 qos_fix_offset = QOS_TYPE_BANK_OFF(QOS_TYPE_FIX, bank);
+	__u32 qos_be_offset = QOS_TYPE_BANK_OFF(QOS_TYPE_BE, bank);
 
-	exe_membank = 0;
-	qos_fix_offset |= (QOS_TYPE_FIX << 13) & 0x0000E000;
-	qos_fix_offset |= ((exe_membank ^ 0x00000001) << 12) & 0x00001000;
+	qos_bank_load(QOS_SHADOW(QOS_TYPE_FIX, bank), qos_fix_offset, 0,
+		      QOS_MASTER_NUM);
+	qos_bank_load(QOS_SHADOW(QOS_TYPE_BE, bank), qos_be_offset, 0,
+		      QOS_MASTER_NUM);
 
-	qos_be_offset |= (QOS_TYPE_BE << 13) & 0x0000E000;
-	qos_be_offset |= ((exe_membank ^ 0x00000001) << 12) & 0x00001000;
+	trace_qos_sram_reload(qos_fix_offset, qos_be_offset, QOS_MASTER_NUM);
+}
 
-	QOS_DBG("QoS Fix Offset[0x%08x]\n", qos_fix_offset);
-	QOS_DBG("QoS BE  Offset[0x%08x]\n", qos_be_offset);
+int rcar_qos_resume(void)
+{
+	__u32 exe_membank = 0;
+	int ret = 0;
 
-	qos_sram_reload(qos_fix_offset, qos_be_offset);
+	QOS_DBG("begin");
 
-	value = exe_membank & 0xFFFFFFFE;
-	value |= (exe_membank ^ 0x00000001) & 0x00000001;
+	qos_mutex_lock();
+
+	if (!init || qos_sram_retained())
+		goto err_i1;
+
+	/* Without a readback the bank in use after reset is bank 0 */
+	if (support_exe_membank)
+		exe_membank = (READ_REG32(qos_reg_base + QOSCTRL_MEMBANK)
+				& EXE_MEMBANK_MASK) >> 8;
+
+	/* Only the standby bank is rewritten while the masters run on it */
+	qos_sram_reload(exe_membank ^ 0x00000001);
+
+	ret = rcar_qos_wait_switching(exe_membank ^ 0x00000001);
+	if (ret)
+		goto err_i1;
+
+	qos_sram_reload(exe_membank);
+
+	if (exe_membank_bk == exe_membank)
+		ret = rcar_qos_wait_switching(exe_membank_bk);
 
-	rcar_qos_wait_switching(value);
+err_i1:
+	mutex_unlock(&qos_mutex);
 
-	qos_fix_offset = 0x00000000;
-	qos_fix_offset |= (QOS_TYPE_FIX << 13) & 0x0000E000;
-	qos_fix_offset |= (exe_membank << 12) & 0x00001000;
+	QOS_DBG("end");
 
-	qos_be_offset = 0x00000000;
-	qos_be_offset |= (QOS_TYPE_BE << 13) & 0x0000E000;
-	qos_be_offset |= (exe_membank << 12) & 0x00001000;
+	return ret;
+}
+
+/* Write entries first to first + num - 1 of the bank at @offset from @src */
+static void qos_bank_load(const __u64 *src, __u32 offset, int first, int num)
+{
+	void __iomem *reg = qos_reg_base + offset + QOS_BANK_OFF(first);
+	int i;
 
-	QOS_DBG("QoS Fix Offset[0x%08x]\n", qos_fix_offset);
-	QOS_DBG("QoS BE  Offset[0x%08x]\n", qos_be_offset);
+	src += first;
+
+	switch (bank_xfer) {
+	case QOS_XFER_RELAXED:
+		qos_stats_add(QOS_STAT_MMIO_WRITE, num);
+		for (i = 0; i < num; i++)
+			writeq_relaxed(src[i], reg + QOS_BANK_OFF(i));
+		break;
+	case QOS_XFER_BURST:
+		qos_stats_add(QOS_STAT_MMIO_WRITE, num);
+		__iowrite64_copy(reg, src, num);
+		break;
+	case QOS_XFER_LO_HI:
+		qos_stats_add(QOS_STAT_MMIO_WRITE, num * 2);
+		for (i = 0; i < num; i++) {
+			writel_relaxed((__u32)src[i], reg + QOS_BANK_OFF(i));
+			writel_relaxed((__u32)(src[i] >> 32),
+				       reg + QOS_BANK_OFF(i) + 4);
+		}
+		break;
+	default:
+		for (i = 0; i < num; i++)
+			WRITE_REG64(src[i], reg + QOS_BANK_OFF(i));
+		break;
+	}
+}
 
-	qos_sram_reload(qos_fix_offset, qos_be_offset);
+/* Read the first @num entries of the bank at @offset into @dst */
+static void qos_bank_store(__u64 *dst, __u32 offset, int num)
+{
+	void __iomem *reg = qos_reg_base + offset;
+	int i;
 
-	if (exe_membank_bk == 0) {
-		value = exe_membank_bk;
-		rcar_qos_wait_switching(value);
+	switch (bank_xfer) {
+	case QOS_XFER_RELAXED:
+		qos_stats_add(QOS_STAT_MMIO_READ, num);
+		for (i = 0; i < num; i++)
+			dst[i] = readq_relaxed(reg + QOS_BANK_OFF(i));
+		break;
+	case QOS_XFER_BURST:
+		qos_stats_add(QOS_STAT_MMIO_READ, num);
+		memcpy_fromio(dst, reg, num * QOS_BANK_SIZE);
+		break;
+	case QOS_XFER_LO_HI:
+		qos_stats_add(QOS_STAT_MMIO_READ, num * 2);
+		for (i = 0; i < num; i++) {
+			dst[i] = readl_relaxed(reg + QOS_BANK_OFF(i));
+			dst[i] |= (__u64)readl_relaxed(reg + QOS_BANK_OFF(i) + 4)
+					<< 32;
+		}
+		break;
+	default:
+		for (i = 0; i < num; i++)
+			dst[i] = READ_REG64(reg + QOS_BANK_OFF(i));
+		break;
 	}
 }
 
-static inline void qos_reg_load(void *src, __u32 offset, int index)
+static void qos_bank_sync(int type, __u32 bank)
 {
-	/* QOS_DBG("[%d] Write value 0x%016llx to IP address 0x%08x\n", index, \
-		*((__u64 *)(src + QOS_BANK_OFF(index))), \
-		(qos_base + offset + QOS_BANK_OFF(index))); */
-	WRITE_REG64(*((__u64 *)(src + QOS_BANK_OFF(index))),
-		qos_reg_base + offset + QOS_BANK_OFF(index));
+	__u64 *shadow = QOS_SHADOW(type, bank);
+	__u32 offset = QOS_TYPE_BANK_OFF(type, bank);
+
+	if (qos_shadow_valid[type][bank])
+		return;
+
+	qos_bank_store(shadow, offset, QOS_MASTER_NUM);
+
+	trace_qos_bank_sync(type, bank, QOS_MASTER_NUM, 0);
+
+	write_seqlock(&qos_shadow_lock);
+	qos_shadow_valid[type][bank] = true;
+	write_sequnlock(&qos_shadow_lock);
+}
+
+/*
+ * Program the first @num entries of @bank of @type from @src, issuing a
+ * register write only for the entries that differ from the shadow.
+ * Returns the number of entries written.
+ */
+static int qos_bank_update(int type, __u32 bank, const __u64 *src, int num)
+{
+	__u64 *shadow = QOS_SHADOW(type, bank);
+	__u32 offset = QOS_TYPE_BANK_OFF(type, bank);
+	bool valid;
+	int count = 0;
+	int i, j;
+
+	/* A partial update needs to know what the rest of the bank holds */
+	if (num < QOS_MASTER_NUM)
+		qos_bank_sync(type, bank);
+
+	valid = qos_shadow_valid[type][bank];
+
+	/* Runs of changed entries go out as one transfer each */
+	for (i = 0; i < num; i = j) {
+		j = i + 1;
+		if (valid && (shadow[i] == src[i]))
+			continue;
+
+		while ((j < num) && !(valid && (shadow[j] == src[j])))
+			j++;
+
+		write_seqlock(&qos_shadow_lock);
+		memcpy(shadow + i, src + i, (j - i) * sizeof(*shadow));
+		write_sequnlock(&qos_shadow_lock);
+		qos_bank_load(shadow, offset, i, j - i);
+		count += j - i;
+	}
+
+	write_seqlock(&qos_shadow_lock);
+	qos_shadow_valid[type][bank] = true;
+	write_sequnlock(&qos_shadow_lock);
+
+	return count;
 }
 
-static inline void qos_reg_store(void *dst, __u32 offset, int index)
+static void qos_entry_update(int type, __u32 bank, int index, __u64 value)
 {
-	*((__u64 *)(dst + QOS_BANK_OFF(index))) =
-		READ_REG64(qos_reg_base + offset + QOS_BANK_OFF(index));
-	/* QOS_DBG("[%d] Store value 0x%016llx of IP address 0x%08x\n", index, \
-		*((__u64 *)(dst + QOS_BANK_OFF(index))), \
-		(qos_base + offset + QOS_BANK_OFF(index))); */
+	__u64 *shadow = QOS_SHADOW(type, bank);
+
+	if (shadow[index] == value)
+		return;
+
+	write_seqlock(&qos_shadow_lock);
+	shadow[index] = value;
+	write_sequnlock(&qos_shadow_lock);
+	qos_bank_load(shadow, QOS_TYPE_BANK_OFF(type, bank), index, 1);
 }
 
 static int rcar_qos_wait_switching(__u32 value)
 {
+	__u64 start = qos_stats_ns();
 	int ret = 0;
 
 	QOS_DBG("Write Reg[QOS_REG_TYPE_MEMORY_BANK][0x%08x], value[0x%08x]\n",
 						(qos_base + QOSCTRL_MEMBANK), value);
+	trace_qos_membank_write(value);
+	qos_stats_inc(QOS_STAT_SWITCH);
 	WRITE_REG32(value, qos_reg_base + QOSCTRL_MEMBANK);
 
 	if (!support_exe_membank) {
@@ -574,10 +1673,13 @@ static int rcar_qos_wait_switching(__u32 value)
 			WAIT_SWITCH_BANK_US_MAX);
 	} else {
 		int timeout = WAIT_RETRY_COUNT;
+		int poll = 0;
 		__u32 memory_bank;
 
 		while (timeout--) {
 			memory_bank = READ_REG32(qos_reg_base + QOSCTRL_MEMBANK);
+			trace_qos_switch_poll(memory_bank, timeout);
+			poll++;
 			if (((memory_bank & EXE_MEMBANK_MASK) >> 8)
 						== (memory_bank & 0x00000001)) {
 				break;
@@ -585,12 +1687,17 @@ static int rcar_qos_wait_switching(__u32 value)
 			udelay(WAIT_SWITCH_BANK_US);
 		}
 
+		qos_stats_hist(QOS_HIST_SWITCH_POLL, poll);
+
 		if (timeout <= 0) {
 			ret = -ETIMEDOUT;
+			qos_stats_inc(QOS_STAT_SWITCH_TIMEOUT);
 			pr_err("rcar_qos_switch_membank: timeout switch membank[errno=%d]\n",
 				ret);
 		}
 	}
 
+	qos_stats_hist(QOS_HIST_SWITCH_NS, qos_stats_ns() - start);
+
 	return ret;
 }
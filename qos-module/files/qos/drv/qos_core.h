@@ -61,13 +61,74 @@
 #ifndef __QOS_CORE_H__
 #define __QOS_CORE_H__
 
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/eventfd.h>
+#include <linux/cred.h>
+#include <linux/device.h>
+
 #include "qos.h"
 
+/* Signalled each time an asynchronous bank switch has finished */
+struct qos_switch_notifier {
+	struct list_head list;
+	struct eventfd_ctx *eventfd;
+};
+
 int rcar_qos_init(void);
+void rcar_qos_attach(void);
 void rcar_qos_exit(void);
 int rcar_qos_set_all_qos(struct qos_ioc_set_all_qos_param *param);
+int rcar_qos_set_qos_table(const __u64 *fix_qos, const __u64 *be_qos, int num);
+int rcar_qos_commit_qos_table(const __u64 *fix_qos, const __u64 *be_qos,
+			      int num, __u8 *exe_membank);
+int rcar_qos_set_ip_qos(const struct qos_ioc_set_ip_qos_param *ip_qos,
+			const __u64 *mask, __u32 num);
+int rcar_qos_commit_ip_qos(const struct qos_ioc_set_ip_qos_param *ip_qos,
+			   const __u64 *mask, __u32 num, __u8 *exe_membank);
+int rcar_qos_apply_ip_qos(const struct qos_ioc_set_ip_qos_param *ip_qos,
+			  const __u64 *mask, __u32 num, __u8 *exe_membank);
+__u64 rcar_qos_get_commit_gen(void);
+int rcar_qos_commit_txn(const struct qos_ioc_set_ip_qos_param *ip_qos,
+			const __u64 *mask, __u32 num, __u64 since_gen,
+			bool merge, __u32 *conflicts, __u8 *exe_membank);
 int rcar_qos_switch_membank(void);
+int rcar_qos_switch_membank_async(__u64 *seq);
+int rcar_qos_schedule_switch(__u64 deadline_ns, __u64 *seq);
+int rcar_qos_cancel_switch(void);
+int rcar_qos_get_switch_status(struct qos_ioc_switch_status_param *param);
+__u64 rcar_qos_get_switch_done_seq(void);
+wait_queue_head_t *rcar_qos_get_switch_wq(void);
+void rcar_qos_register_switch_notifier(struct qos_switch_notifier *nb);
+void rcar_qos_unregister_switch_notifier(struct qos_switch_notifier *nb);
+int rcar_qos_get_master_id_max(void);
+__u32 rcar_qos_get_product(void);
+int rcar_qos_get_status(struct qos_ioc_get_status_param *param);
+int rcar_qos_get_ip_qos(struct qos_ioc_get_ip_qos_param *param);
+int rcar_qos_get_all_qos(__u64 *fix_qos, __u64 *be_qos,
+			 __u8 membank, __u8 flags);
 void rcar_qos_suspend(void);
-void rcar_qos_resume(void);
+int rcar_qos_resume(void);
+
+int rcar_qos_register_profile(__u32 id, const char *name,
+			      const __u64 *fix_qos, const __u64 *be_qos);
+int rcar_qos_unregister_profile(__u32 id);
+void rcar_qos_install_profiles(const __u32 *id, const char * const *name,
+			       __u64 * const *table, int num);
+int rcar_qos_activate_profile(__u32 id, __u8 *exe_membank);
+void rcar_qos_profile_exit(void);
+int rcar_qos_register_hw_profile(void);
+
+int rcar_qos_load_firmware(struct device *dev);
+
+int rcar_qos_set_partition(__u32 uid, const __u64 *map);
+int rcar_qos_check_partition(const struct cred *cred,
+			     const struct qos_ioc_set_ip_qos_param *ip_qos,
+			     __u32 num);
+int rcar_qos_set_group_window(__u32 window_us);
+int rcar_qos_group_commit(const struct qos_ioc_set_ip_qos_param *ip_qos,
+			  const __u64 *mask, __u32 num, bool nowait,
+			  __u64 *seq, __u8 *exe_membank);
+void rcar_qos_partition_exit(void);
 
 #endif /* __QOS_CORE_H__ */
@@ -67,11 +67,19 @@
 #include <linux/of_device.h>
 #include <linux/platform_device.h>
 #include <linux/ioctl.h>
+#include <linux/mutex.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/eventfd.h>
+#include <linux/capability.h>
 #include <linux/uaccess.h>
 
 #include "qos_core.h"
 #include "qos_reg.h"
+#include "qos_stats.h"
+#include "qos_trace.h"
 
 /* #define DEBUG */
 
@@ -82,24 +90,113 @@
 #define QOS_DBG(fmt, args...) do { } while (0)
 #endif
 
-static int qos_set_all_qos(unsigned long arg);
-static int qos_switch_membank(unsigned long arg);
+static int qos_set_ip_qos(struct file *filp, unsigned long arg);
+static int qos_set_all_qos(struct file *filp, unsigned long arg);
+static int qos_get_ip_qos(struct file *filp, unsigned long arg);
+static int qos_switch_membank(struct file *filp, unsigned long arg);
+static int qos_get_status(struct file *filp, unsigned long arg);
+static int qos_set_multi_ip_qos(struct file *filp, unsigned long arg);
+static int qos_get_all_qos(struct file *filp, unsigned long arg);
+static int qos_commit_staging(struct file *filp, unsigned long arg);
+static int qos_set_qos_table(struct file *filp, unsigned long arg);
+static int qos_commit_qos_table(struct file *filp, unsigned long arg);
+static int qos_switch_membank_async(struct file *filp, unsigned long arg);
+static int qos_get_switch_status(struct file *filp, unsigned long arg);
+static int qos_set_switch_eventfd(struct file *filp, unsigned long arg);
+static int qos_schedule_switch(struct file *filp, unsigned long arg);
+static int qos_cancel_switch(struct file *filp, unsigned long arg);
+static int qos_register_profile(struct file *filp, unsigned long arg);
+static int qos_unregister_profile(struct file *filp, unsigned long arg);
+static int qos_activate_profile(struct file *filp, unsigned long arg);
+static int qos_txn_begin(struct file *filp, unsigned long arg);
+static int qos_txn_set(struct file *filp, unsigned long arg);
+static int qos_txn_commit(struct file *filp, unsigned long arg);
+static int qos_txn_abort(struct file *filp, unsigned long arg);
+static int qos_set_partition(struct file *filp, unsigned long arg);
+static int qos_group_commit(struct file *filp, unsigned long arg);
+static int qos_set_group_window(struct file *filp, unsigned long arg);
+
+static bool warm_attach;
+module_param(warm_attach, bool, 0444);
+MODULE_PARM_DESC(warm_attach,
+		 "Adopt the tables already in the QoS banks on load");
+
+typedef int (*qos_ioctl_t)(struct file *, unsigned long);
+
+/*
+ * Open transaction of a file. qos and mask are dense, indexed by
+ * type * (master_id_max + 1) + master_id, a zero mask meaning the entry
+ * is not part of the transaction; ip_qos is the scratch for the commit.
+ */
+struct qos_txn {
+	__u64 gen;
+	__u64 *qos;
+	__u64 *mask;
+	struct qos_ioc_set_ip_qos_param *ip_qos;
+};
 
-typedef int (*qos_ioctl_t)(unsigned long);
+struct qos_file {
+	struct mutex lock;
+	struct qos_txn *txn;	/* NULL when no transaction is open */
+	void *staging;		/* QOS_STAGING_SIZE, mapped to user space */
+	__u64 *table;		/* FIX and BE copy buffers, master_id_max + 1 each */
+	struct qos_ioc_set_ip_qos_param *ip_qos; /* group commit entries */
+	__u64 switch_seq;	/* last asynchronous switch issued on this file */
+	struct qos_switch_notifier notifier;
+};
 
 uint32_t qos_base;
 void __iomem *qos_reg_base;
 static struct platform_device *g_qos_pdev;
 
 static const qos_ioctl_t qos_ioctls[QOS_IOCTL_MAX_NR] = {
+	[_IOC_NR(QOS_IOCTL_SET_IP_QOS)] = qos_set_ip_qos,
 	[_IOC_NR(QOS_IOCTL_SET_ALL_QOS)] = qos_set_all_qos,
+	[_IOC_NR(QOS_IOCTL_GET_IP_QOS)] = qos_get_ip_qos,
 	[_IOC_NR(QOS_IOCTL_SWITCH_MEMBANK)] = qos_switch_membank,
+	[_IOC_NR(QOS_IOCTL_GET_STATUS)] = qos_get_status,
+	[_IOC_NR(QOS_IOCTL_SET_MULTI_IP_QOS)] = qos_set_multi_ip_qos,
+	[_IOC_NR(QOS_IOCTL_GET_ALL_QOS)] = qos_get_all_qos,
+	[_IOC_NR(QOS_IOCTL_COMMIT_STAGING)] = qos_commit_staging,
+	[_IOC_NR(QOS_IOCTL_SET_QOS_TABLE)] = qos_set_qos_table,
+	[_IOC_NR(QOS_IOCTL_COMMIT_QOS_TABLE)] = qos_commit_qos_table,
+	[_IOC_NR(QOS_IOCTL_SWITCH_MEMBANK_ASYNC)] = qos_switch_membank_async,
+	[_IOC_NR(QOS_IOCTL_GET_SWITCH_STATUS)] = qos_get_switch_status,
+	[_IOC_NR(QOS_IOCTL_SET_SWITCH_EVENTFD)] = qos_set_switch_eventfd,
+	[_IOC_NR(QOS_IOCTL_SCHEDULE_SWITCH)] = qos_schedule_switch,
+	[_IOC_NR(QOS_IOCTL_CANCEL_SWITCH)] = qos_cancel_switch,
+	[_IOC_NR(QOS_IOCTL_REGISTER_PROFILE)] = qos_register_profile,
+	[_IOC_NR(QOS_IOCTL_UNREGISTER_PROFILE)] = qos_unregister_profile,
+	[_IOC_NR(QOS_IOCTL_ACTIVATE_PROFILE)] = qos_activate_profile,
+	[_IOC_NR(QOS_IOCTL_TXN_BEGIN)] = qos_txn_begin,
+	[_IOC_NR(QOS_IOCTL_TXN_SET)] = qos_txn_set,
+	[_IOC_NR(QOS_IOCTL_TXN_COMMIT)] = qos_txn_commit,
+	[_IOC_NR(QOS_IOCTL_TXN_ABORT)] = qos_txn_abort,
+	[_IOC_NR(QOS_IOCTL_SET_PARTITION)] = qos_set_partition,
+	[_IOC_NR(QOS_IOCTL_GROUP_COMMIT)] = qos_group_commit,
+	[_IOC_NR(QOS_IOCTL_SET_GROUP_WINDOW)] = qos_set_group_window,
 };
 
 static int qos_open(struct inode *inode, struct file *filp)
 {
+	struct qos_file *qf;
+
 	QOS_DBG("begin");
 
+	qf = kzalloc(sizeof(*qf), GFP_KERNEL);
+	if (qf == NULL)
+		return -ENOMEM;
+
+	qf->table = kmalloc_array((rcar_qos_get_master_id_max() + 1) * 2,
+				  sizeof(__u64), GFP_KERNEL);
+	if (qf->table == NULL) {
+		kfree(qf);
+		return -ENOMEM;
+	}
+
+	mutex_init(&qf->lock);
+	filp->private_data = qf;
+
 	QOS_DBG("end");
 
 	return 0;
@@ -124,17 +221,88 @@ static long qos_unlocked_ioctl(struct file *filp, unsigned int cmd,
 		return -ENOTTY;
 	}
 
-	ret = func(arg);
+	trace_qos_ioctl_enter(cmd);
+	ret = func(filp, arg);
+	trace_qos_ioctl_exit(cmd, ret);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct qos_file *qf = filp->private_data;
+	int ret = 0;
+
+	QOS_DBG("begin");
+
+	if ((vma->vm_pgoff != 0) ||
+	    (vma->vm_end - vma->vm_start > QOS_STAGING_SIZE))
+		return -EINVAL;
+
+	mutex_lock(&qf->lock);
+
+	if (qf->staging == NULL) {
+		qf->staging = vmalloc_user(QOS_STAGING_SIZE);
+		if (qf->staging == NULL) {
+			ret = -ENOMEM;
+			goto err_i1;
+		}
+	}
+
+	ret = remap_vmalloc_range(vma, qf->staging, 0);
+
+err_i1:
+	mutex_unlock(&qf->lock);
 
 	QOS_DBG("end");
 
 	return ret;
 }
 
+/* Readable once the last asynchronous switch of this file has finished */
+static __poll_t qos_poll(struct file *filp, poll_table *wait)
+{
+	struct qos_file *qf = filp->private_data;
+	__u64 seq = READ_ONCE(qf->switch_seq);
+
+	poll_wait(filp, rcar_qos_get_switch_wq(), wait);
+
+	if (seq && (rcar_qos_get_switch_done_seq() >= seq))
+		return EPOLLIN | EPOLLRDNORM;
+
+	return 0;
+}
+
+static void qos_txn_free(struct qos_txn *txn)
+{
+	if (txn == NULL)
+		return;
+
+	kfree(txn->qos);
+	kfree(txn->mask);
+	kfree(txn->ip_qos);
+	kfree(txn);
+}
+
 static int qos_close(struct inode *inode, struct file *filp)
 {
+	struct qos_file *qf = filp->private_data;
+
 	QOS_DBG("begin");
 
+	if (qf->notifier.eventfd) {
+		rcar_qos_unregister_switch_notifier(&qf->notifier);
+		eventfd_ctx_put(qf->notifier.eventfd);
+	}
+
+	qos_txn_free(qf->txn);
+	vfree(qf->staging);
+	kfree(qf->table);
+	kfree(qf->ip_qos);
+	kfree(qf);
+
 	QOS_DBG("end");
 
 	return 0;
@@ -143,6 +311,8 @@ static int qos_close(struct inode *inode, struct file *filp)
 static const struct file_operations qos_fops = {
 	.owner	  = THIS_MODULE,
 	.unlocked_ioctl = qos_unlocked_ioctl,
+	.mmap	   = qos_mmap,
+	.poll	   = qos_poll,
 	.open	   = qos_open,
 	.release	= qos_close,
 };
@@ -162,8 +332,7 @@ static int qos_pm_suspend(struct device *dev)
 
 static int qos_pm_resume(struct device *dev)
 {
-	rcar_qos_resume();
-	return 0;
+	return rcar_qos_resume();
 }
 #endif
 
@@ -235,22 +404,46 @@ static int __init qos_init(void)
 		return -EINVAL;
 	}
 
-	ret = misc_register(&qos_miscdev);
+	/* Open allocates buffers sized by master_id_max, so detect the SoC first */
+	ret = rcar_qos_init();
 	if (ret) {
-		pr_err("failed to misc_register (MISC_DYNAMIC_MINOR)\n");
-		return ret;
+		pr_err("failed to rcar_qos_init()\n");
+		goto err_i1;
 	}
 
-	ret = rcar_qos_init();
+	if (warm_attach) {
+		rcar_qos_attach();
+		if (rcar_qos_register_hw_profile())
+			pr_warn("QoS: hardware default profile not registered\n");
+	}
+
+	/* Without a usable image the tables are left to user space */
+	if (rcar_qos_load_firmware(&g_qos_pdev->dev))
+		pr_warn("QoS: profile image %s not applied\n", QOS_FW_NAME);
+
+	/* Statistics are a debugging aid, the driver works without them */
+	if (rcar_qos_stats_init())
+		pr_warn("QoS: debugfs statistics are not available\n");
+
+	ret = misc_register(&qos_miscdev);
 	if (ret) {
-		pr_err("failed to rcar_qos_init()\n");
-		return ret;
+		pr_err("failed to misc_register (MISC_DYNAMIC_MINOR)\n");
+		goto err_i2;
 	}
 
 	pr_info("QoS Driver is Successfully loaded\n");
 
 	QOS_DBG("end");
 
+	return ret;
+
+err_i2:
+	rcar_qos_stats_exit();
+	rcar_qos_profile_exit();
+err_i1:
+	rcar_qos_exit();
+	platform_driver_unregister(&qos_driver);
+
 	return ret;
 }
 
@@ -260,10 +453,18 @@ static void __exit qos_exit(void)
 
 	misc_deregister(&qos_miscdev);
 
-	platform_driver_unregister(&qos_driver);
-
+	/*
+	 * The group commit work and an asynchronous or scheduled switch
+	 * access the registers, so they are stopped before the platform
+	 * driver unmaps them.
+	 */
+	rcar_qos_stats_exit();
+	rcar_qos_partition_exit();
+	rcar_qos_profile_exit();
 	rcar_qos_exit();
 
+	platform_driver_unregister(&qos_driver);
+
 	pr_info("QoS Driver is unloaded\n");
 
 	QOS_DBG("end");
@@ -273,50 +474,331 @@ static void __exit qos_exit(void)
 module_init(qos_init);
 module_exit(qos_exit);
 MODULE_LICENSE("Dual MIT/GPL");
+MODULE_FIRMWARE(QOS_FW_NAME);
 
-static int qos_set_all_qos(unsigned long arg)
+static int qos_set_ip_qos(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_ioc_set_ip_qos_param param;
+
+	QOS_DBG("begin");
+
+	if (copy_from_user(&param, (void __user *)arg, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	ret = rcar_qos_check_partition(filp->f_cred, &param, 1);
+	if (ret)
+		return ret;
+
+	ret = rcar_qos_set_ip_qos(&param, NULL, 1);
+	if (ret) {
+		pr_err("QoS(%s): failed to rcar_qos_set_ip_qos() errno=[%d]\n",
+		       __func__, ret);
+		return ret;
+	}
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+/* Stage the user tables, and switch to them when @exe_membank is given */
+static int qos_copy_qos_table(struct file *filp, __u8 __user *fix_qos,
+			      __u8 __user *be_qos, int num, __u8 *exe_membank)
+{
+	int ret = 0;
+	struct qos_file *qf = filp->private_data;
+	__u64 *fix_buf = NULL;
+	__u64 *be_buf = NULL;
+	size_t size = num * sizeof(__u64);
+
+	/* Whole tables reach masters outside any partition */
+	ret = rcar_qos_check_partition(filp->f_cred, NULL, 0);
+	if (ret)
+		return ret;
+
+	mutex_lock(&qf->lock);
+
+	if (fix_qos) {
+		fix_buf = qf->table;
+		if (copy_from_user(fix_buf, (void __user *)fix_qos, size)) {
+			pr_err("QoS(%s): copy param error\n", __func__);
+			ret = -EFAULT;
+			goto err_i1;
+		}
+	}
+
+	if (be_qos) {
+		be_buf = qf->table + rcar_qos_get_master_id_max() + 1;
+		if (copy_from_user(be_buf, (void __user *)be_qos, size)) {
+			pr_err("QoS(%s): copy param error\n", __func__);
+			ret = -EFAULT;
+			goto err_i1;
+		}
+	}
+
+	trace_qos_table_copy(num, (fix_qos ? size : 0) + (be_qos ? size : 0));
+
+	if (exe_membank) {
+		ret = rcar_qos_commit_qos_table(fix_buf, be_buf, num,
+						exe_membank);
+		if (ret) {
+			pr_err("QoS(%s): failed to rcar_qos_commit_qos_table() errno=[%d]\n",
+			       __func__, ret);
+			goto err_i1;
+		}
+	} else {
+		ret = rcar_qos_set_qos_table(fix_buf, be_buf, num);
+		if (ret) {
+			pr_err("QoS(%s): failed to rcar_qos_set_qos_table() errno=[%d]\n",
+			       __func__, ret);
+			goto err_i1;
+		}
+	}
+
+err_i1:
+	mutex_unlock(&qf->lock);
+
+	return ret;
+}
+
+static int qos_set_all_qos(struct file *filp, unsigned long arg)
 {
 	int ret = 0;
-	struct qos_ioc_set_all_qos_param param;
 	struct qos_ioc_set_all_qos_param tmp;
 
 	QOS_DBG("begin");
 
-	param.fix_qos = NULL;
-	param.be_qos = NULL;
+	qos_stats_inc(QOS_STAT_SET_ALL_QOS);
 
-	param.fix_qos = kmalloc(QOS_FIX_BANK_SIZE, GFP_KERNEL);
-	if (param.fix_qos == NULL) {
-		ret = -ENOMEM;
-		goto err_i1;
+	if (copy_from_user(&tmp, (void __user *)arg, sizeof(tmp))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
 	}
 
-	param.be_qos = kmalloc(QOS_BE_BANK_SIZE, GFP_KERNEL);
-	if (param.be_qos == NULL) {
-		ret = -ENOMEM;
-		goto err_i1;
+	/* Only the entries the SoC implements are copied */
+	ret = qos_copy_qos_table(filp, (__u8 __user *)tmp.fix_qos,
+				 (__u8 __user *)tmp.be_qos,
+				 rcar_qos_get_master_id_max() + 1, NULL);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_get_ip_qos(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_ioc_get_ip_qos_param param;
+
+	QOS_DBG("begin");
+
+	if (copy_from_user(&param, (void __user *)arg, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	ret = rcar_qos_get_ip_qos(&param);
+	if (ret)
+		return ret;
+
+	if (copy_to_user((void __user *)arg, &param, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_switch_membank(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+
+	QOS_DBG("begin");
+
+	/* A switch puts every master's staged entries live */
+	ret = rcar_qos_check_partition(filp->f_cred, NULL, 0);
+	if (ret)
+		return ret;
+
+	ret = rcar_qos_switch_membank();
+	if (ret) {
+		pr_err("QoS(%s): failed to rcar_qos_switch_membank() errno=[%d]\n",
+		       __func__, ret);
+		return ret;
 	}
 
+	QOS_DBG("end");
+
+	return ret;
+}
+
+/* Requests up to this size are copied on the stack instead of kmalloc */
+#define QOS_MULTI_IP_QOS_STACK_NUM	16
+
+static int qos_set_multi_ip_qos(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_ioc_set_multi_ip_qos_param tmp;
+	struct qos_ioc_set_ip_qos_param ip_qos_stack[QOS_MULTI_IP_QOS_STACK_NUM];
+	__u64 mask_stack[QOS_MULTI_IP_QOS_STACK_NUM];
+	struct qos_ioc_set_ip_qos_param *ip_qos = ip_qos_stack;
+	__u64 *mask = mask_stack;
+
+	QOS_DBG("begin");
+
 	if (copy_from_user(&tmp, (void __user *)arg, sizeof(tmp))) {
 		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	if (tmp.num == 0)
+		return 0;
+
+	if (tmp.num > QOS_MULTI_IP_QOS_NUM_MAX) {
+		pr_err("QoS(%s): too many entries[%u]\n", __func__, tmp.num);
+		return -EINVAL;
+	}
+
+	if (tmp.num > QOS_MULTI_IP_QOS_STACK_NUM) {
+		ip_qos = kmalloc_array(tmp.num, sizeof(*ip_qos), GFP_KERNEL);
+		mask = kmalloc_array(tmp.num, sizeof(*mask), GFP_KERNEL);
+		if (ip_qos == NULL || mask == NULL) {
+			ret = -ENOMEM;
+			goto err_i1;
+		}
+	}
+
+	if (copy_from_user(ip_qos, (void __user *)(tmp.ip_qos),
+			   tmp.num * sizeof(*ip_qos))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
 		ret = -EFAULT;
 		goto err_i1;
 	}
 
-	if (copy_from_user(param.fix_qos,
-		(void __user *)(tmp.fix_qos), QOS_FIX_BANK_SIZE)) {
+	if (tmp.mask && copy_from_user(mask, (void __user *)(tmp.mask),
+				       tmp.num * sizeof(*mask))) {
 		pr_err("QoS(%s): copy param error\n", __func__);
 		ret = -EFAULT;
 		goto err_i1;
 	}
 
-	if (copy_from_user(param.be_qos,
-		(void __user *)(tmp.be_qos), QOS_BE_BANK_SIZE)) {
+	ret = rcar_qos_check_partition(filp->f_cred, ip_qos, tmp.num);
+	if (ret)
+		goto err_i1;
+
+	ret = rcar_qos_set_ip_qos(ip_qos, tmp.mask ? mask : NULL, tmp.num);
+	if (ret) {
+		pr_err("QoS(%s): failed to rcar_qos_set_ip_qos() errno=[%d]\n",
+		       __func__, ret);
+		goto err_i1;
+	}
+
+err_i1:
+	if (ip_qos != ip_qos_stack)
+		kfree(ip_qos);
+	if (mask != mask_stack)
+		kfree(mask);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_get_status(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_ioc_get_status_param param;
+
+	QOS_DBG("begin");
+
+	if (copy_from_user(&param, (void __user *)arg, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	ret = rcar_qos_get_status(&param);
+	if (ret)
+		return ret;
+
+	if (copy_to_user((void __user *)arg, &param, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_get_all_qos(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_file *qf = filp->private_data;
+	struct qos_ioc_get_all_qos_param tmp;
+	int num = rcar_qos_get_master_id_max() + 1;
+
+	QOS_DBG("begin");
+
+	if (copy_from_user(&tmp, (void __user *)arg, sizeof(tmp))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	mutex_lock(&qf->lock);
+
+	ret = rcar_qos_get_all_qos(qf->table, qf->table + num,
+				   tmp.membank, tmp.flags);
+	if (ret)
+		goto err_i1;
+
+	if (copy_to_user((void __user *)(tmp.fix_qos), qf->table,
+			 num * sizeof(__u64)) ||
+	    copy_to_user((void __user *)(tmp.be_qos), qf->table + num,
+			 num * sizeof(__u64))) {
 		pr_err("QoS(%s): copy param error\n", __func__);
 		ret = -EFAULT;
 		goto err_i1;
 	}
 
+err_i1:
+	mutex_unlock(&qf->lock);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_commit_staging(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_file *qf = filp->private_data;
+	struct qos_ioc_set_all_qos_param param;
+
+	QOS_DBG("begin");
+
+	qos_stats_inc(QOS_STAT_COMMIT_STAGING);
+
+	ret = rcar_qos_check_partition(filp->f_cred, NULL, 0);
+	if (ret)
+		return ret;
+
+	mutex_lock(&qf->lock);
+
+	if (qf->staging == NULL) {
+		pr_err("QoS(%s): staging area is not mapped\n", __func__);
+		ret = -EINVAL;
+		goto err_i1;
+	}
+
+	/* Program the standby bank straight from the page shared with user */
+	param.fix_qos = (__u8 *)qf->staging + QOS_STAGING_FIX_OFFSET;
+	param.be_qos = (__u8 *)qf->staging + QOS_STAGING_BE_OFFSET;
+
 	ret = rcar_qos_set_all_qos(&param);
 	if (ret) {
 		pr_err("QoS(%s): failed to rcar_qos_set_all_qos() errno=[%d]\n",
@@ -325,28 +807,680 @@ static int qos_set_all_qos(unsigned long arg)
 	}
 
 err_i1:
-	kfree(param.fix_qos);
-	kfree(param.be_qos);
+	mutex_unlock(&qf->lock);
 
 	QOS_DBG("end");
 
 	return ret;
 }
 
-static int qos_switch_membank(unsigned long arg)
+static int qos_check_qos_table(struct qos_ioc_set_qos_table_param *tmp)
+{
+	__u32 size = (rcar_qos_get_master_id_max() + 1) * sizeof(__u64);
+
+	if (tmp->length == 0)
+		tmp->length = size;
+
+	if ((tmp->table_mask == 0) || (tmp->table_mask & ~QOS_TABLE_ALL) ||
+	    (tmp->length > size) || (tmp->length % sizeof(__u64))) {
+		pr_err("QoS(%s): invalid length[%u] table mask[0x%x]\n",
+		       __func__, tmp->length, tmp->table_mask);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int qos_set_qos_table(struct file *filp, unsigned long arg)
 {
 	int ret = 0;
+	struct qos_ioc_set_qos_table_param tmp;
 
 	QOS_DBG("begin");
 
-	ret = rcar_qos_switch_membank();
-	if (ret) {
-		pr_err("QoS(%s): failed to rcar_qos_switch_membank() errno=[%d]\n",
-		       __func__, ret);
-		return ret;
+	if (copy_from_user(&tmp, (void __user *)arg, sizeof(tmp))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
 	}
 
+	ret = qos_check_qos_table(&tmp);
+	if (ret)
+		return ret;
+
+	ret = qos_copy_qos_table(filp,
+			(tmp.table_mask & QOS_TABLE_FIX) ?
+				(__u8 __user *)tmp.fix_qos : NULL,
+			(tmp.table_mask & QOS_TABLE_BE) ?
+				(__u8 __user *)tmp.be_qos : NULL,
+			tmp.length / sizeof(__u64), NULL);
+
 	QOS_DBG("end");
 
 	return ret;
 }
+
+static int qos_commit_qos_table(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_ioc_commit_qos_table_param tmp;
+
+	QOS_DBG("begin");
+
+	if (copy_from_user(&tmp, (void __user *)arg, sizeof(tmp))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	ret = qos_check_qos_table(&tmp.table);
+	if (ret)
+		return ret;
+
+	ret = qos_copy_qos_table(filp,
+			(tmp.table.table_mask & QOS_TABLE_FIX) ?
+				(__u8 __user *)tmp.table.fix_qos : NULL,
+			(tmp.table.table_mask & QOS_TABLE_BE) ?
+				(__u8 __user *)tmp.table.be_qos : NULL,
+			tmp.table.length / sizeof(__u64), &tmp.exe_membank);
+	if (ret)
+		return ret;
+
+	if (copy_to_user((void __user *)arg, &tmp, sizeof(tmp))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_switch_membank_async(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_file *qf = filp->private_data;
+	__u64 seq;
+
+	QOS_DBG("begin");
+
+	ret = rcar_qos_check_partition(filp->f_cred, NULL, 0);
+	if (ret)
+		return ret;
+
+	ret = rcar_qos_switch_membank_async(&seq);
+	if (ret) {
+		pr_err("QoS(%s): failed to rcar_qos_switch_membank_async() errno=[%d]\n",
+		       __func__, ret);
+		return ret;
+	}
+
+	WRITE_ONCE(qf->switch_seq, seq);
+
+	if (copy_to_user((void __user *)arg, &seq, sizeof(seq))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_get_switch_status(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_ioc_switch_status_param param;
+
+	QOS_DBG("begin");
+
+	memset(&param, 0, sizeof(param));
+
+	ret = rcar_qos_get_switch_status(&param);
+	if (ret)
+		return ret;
+
+	if (copy_to_user((void __user *)arg, &param, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+/* Register an eventfd signalled on switch completion, or remove it with -1 */
+static int qos_set_switch_eventfd(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_file *qf = filp->private_data;
+	struct eventfd_ctx *ctx = NULL;
+	__s32 fd;
+
+	QOS_DBG("begin");
+
+	if (copy_from_user(&fd, (void __user *)arg, sizeof(fd))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	if (fd >= 0) {
+		ctx = eventfd_ctx_fdget(fd);
+		if (IS_ERR(ctx))
+			return PTR_ERR(ctx);
+	}
+
+	mutex_lock(&qf->lock);
+
+	if (qf->notifier.eventfd) {
+		rcar_qos_unregister_switch_notifier(&qf->notifier);
+		eventfd_ctx_put(qf->notifier.eventfd);
+		qf->notifier.eventfd = NULL;
+	}
+
+	if (ctx) {
+		qf->notifier.eventfd = ctx;
+		rcar_qos_register_switch_notifier(&qf->notifier);
+	}
+
+	mutex_unlock(&qf->lock);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_schedule_switch(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_file *qf = filp->private_data;
+	struct qos_ioc_schedule_switch_param param;
+
+	QOS_DBG("begin");
+
+	if (copy_from_user(&param, (void __user *)arg, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	ret = rcar_qos_check_partition(filp->f_cred, NULL, 0);
+	if (ret)
+		return ret;
+
+	ret = rcar_qos_schedule_switch(param.deadline_ns, &param.seq);
+	if (ret) {
+		pr_err("QoS(%s): failed to rcar_qos_schedule_switch() errno=[%d]\n",
+		       __func__, ret);
+		return ret;
+	}
+
+	WRITE_ONCE(qf->switch_seq, param.seq);
+
+	if (copy_to_user((void __user *)arg, &param, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_cancel_switch(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+
+	QOS_DBG("begin");
+
+	ret = rcar_qos_check_partition(filp->f_cred, NULL, 0);
+	if (ret)
+		return ret;
+
+	ret = rcar_qos_cancel_switch();
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_register_profile(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_file *qf = filp->private_data;
+	struct qos_ioc_register_profile_param tmp;
+	int num = rcar_qos_get_master_id_max() + 1;
+
+	QOS_DBG("begin");
+
+	if (copy_from_user(&tmp, (void __user *)arg, sizeof(tmp))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	/* Profiles are shared by every client and hold whole tables */
+	ret = rcar_qos_check_partition(filp->f_cred, NULL, 0);
+	if (ret)
+		return ret;
+
+	mutex_lock(&qf->lock);
+
+	if (copy_from_user(qf->table, (void __user *)(tmp.fix_qos),
+			   num * sizeof(__u64)) ||
+	    copy_from_user(qf->table + num, (void __user *)(tmp.be_qos),
+			   num * sizeof(__u64))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		ret = -EFAULT;
+		goto err_i1;
+	}
+
+	tmp.name[QOS_PROFILE_NAME_LEN - 1] = '\0';
+
+	ret = rcar_qos_register_profile(tmp.id, tmp.name,
+					qf->table, qf->table + num);
+	if (ret) {
+		pr_err("QoS(%s): failed to rcar_qos_register_profile() errno=[%d]\n",
+		       __func__, ret);
+		goto err_i1;
+	}
+
+err_i1:
+	mutex_unlock(&qf->lock);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_unregister_profile(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	__u32 id;
+
+	QOS_DBG("begin");
+
+	if (copy_from_user(&id, (void __user *)arg, sizeof(id))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	ret = rcar_qos_check_partition(filp->f_cred, NULL, 0);
+	if (ret)
+		return ret;
+
+	ret = rcar_qos_unregister_profile(id);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_activate_profile(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_ioc_activate_profile_param param;
+
+	QOS_DBG("begin");
+
+	if (copy_from_user(&param, (void __user *)arg, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	ret = rcar_qos_check_partition(filp->f_cred, NULL, 0);
+	if (ret)
+		return ret;
+
+	ret = rcar_qos_activate_profile(param.id, &param.exe_membank);
+	if (ret) {
+		pr_err("QoS(%s): failed to rcar_qos_activate_profile() errno=[%d]\n",
+		       __func__, ret);
+		return ret;
+	}
+
+	if (copy_to_user((void __user *)arg, &param, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static struct qos_txn *qos_txn_alloc(void)
+{
+	int num = (rcar_qos_get_master_id_max() + 1) * 2;
+	struct qos_txn *txn;
+
+	txn = kzalloc(sizeof(*txn), GFP_KERNEL);
+	if (txn == NULL)
+		return NULL;
+
+	txn->qos = kcalloc(num, sizeof(*txn->qos), GFP_KERNEL);
+	txn->mask = kcalloc(num, sizeof(*txn->mask), GFP_KERNEL);
+	txn->ip_qos = kcalloc(num, sizeof(*txn->ip_qos), GFP_KERNEL);
+	if ((txn->qos == NULL) || (txn->mask == NULL) ||
+	    (txn->ip_qos == NULL)) {
+		qos_txn_free(txn);
+		return NULL;
+	}
+
+	return txn;
+}
+
+/* Open a transaction, dropping any one left open on this file */
+static int qos_txn_begin(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_file *qf = filp->private_data;
+	int num = (rcar_qos_get_master_id_max() + 1) * 2;
+	__u64 gen;
+
+	QOS_DBG("begin");
+
+	mutex_lock(&qf->lock);
+
+	if (qf->txn == NULL) {
+		qf->txn = qos_txn_alloc();
+		if (qf->txn == NULL) {
+			ret = -ENOMEM;
+			goto err_i1;
+		}
+	} else {
+		memset(qf->txn->mask, 0, num * sizeof(*qf->txn->mask));
+	}
+
+	gen = rcar_qos_get_commit_gen();
+	qf->txn->gen = gen;
+
+	if (copy_to_user((void __user *)arg, &gen, sizeof(gen))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		ret = -EFAULT;
+		goto err_i1;
+	}
+
+err_i1:
+	mutex_unlock(&qf->lock);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_txn_set(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_file *qf = filp->private_data;
+	struct qos_ioc_set_multi_ip_qos_param tmp;
+	int master_num = rcar_qos_get_master_id_max() + 1;
+	struct qos_ioc_set_ip_qos_param *ip_qos;
+	__u64 *mask = qf->table;
+	__u64 m;
+	__u32 i;
+	int n;
+
+	QOS_DBG("begin");
+
+	if (copy_from_user(&tmp, (void __user *)arg, sizeof(tmp))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	if (tmp.num > master_num * 2) {
+		pr_err("QoS(%s): too many entries[%u]\n", __func__, tmp.num);
+		return -EINVAL;
+	}
+
+	mutex_lock(&qf->lock);
+
+	if (qf->txn == NULL) {
+		ret = -EINVAL;
+		goto err_i1;
+	}
+	ip_qos = qf->txn->ip_qos;
+
+	if (copy_from_user(ip_qos, (void __user *)(tmp.ip_qos),
+			   tmp.num * sizeof(*ip_qos)) ||
+	    (tmp.mask && copy_from_user(mask, (void __user *)(tmp.mask),
+					tmp.num * sizeof(*mask)))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		ret = -EFAULT;
+		goto err_i1;
+	}
+
+	for (i = 0; i < tmp.num; i++) {
+		if ((ip_qos[i].qos_type > QOS_TYPE_BE) ||
+		    (ip_qos[i].master_id >= master_num)) {
+			ret = -EINVAL;
+			goto err_i1;
+		}
+	}
+
+	ret = rcar_qos_check_partition(filp->f_cred, ip_qos, tmp.num);
+	if (ret)
+		goto err_i1;
+
+	/* Later entries for the same master are merged under their masks */
+	for (i = 0; i < tmp.num; i++) {
+		n = ip_qos[i].qos_type * master_num + ip_qos[i].master_id;
+		m = tmp.mask ? mask[i] : ~0ULL;
+		qf->txn->qos[n] = (qf->txn->qos[n] & ~m) | (ip_qos[i].qos & m);
+		qf->txn->mask[n] |= m;
+	}
+
+err_i1:
+	mutex_unlock(&qf->lock);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_txn_commit(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_file *qf = filp->private_data;
+	struct qos_ioc_txn_commit_param param;
+	int master_num = rcar_qos_get_master_id_max() + 1;
+	struct qos_txn *txn;
+	__u32 num = 0;
+	int n;
+
+	QOS_DBG("begin");
+
+	if (copy_from_user(&param, (void __user *)arg, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	mutex_lock(&qf->lock);
+
+	txn = qf->txn;
+	if (txn == NULL) {
+		ret = -EINVAL;
+		goto err_i1;
+	}
+
+	for (n = 0; n < master_num * 2; n++) {
+		if (txn->mask[n] == 0)
+			continue;
+		txn->ip_qos[num].qos_type = n / master_num;
+		txn->ip_qos[num].master_id = n % master_num;
+		txn->ip_qos[num].qos = txn->qos[n];
+		qf->table[num] = txn->mask[n];
+		num++;
+	}
+
+	param.conflicts = 0;
+	ret = rcar_qos_commit_txn(txn->ip_qos, qf->table, num, txn->gen,
+				  param.flags & QOS_TXN_FLAG_MERGE,
+				  &param.conflicts, &param.exe_membank);
+
+	/* A transaction that was not applied stays open so it can be retried */
+	if (!ret) {
+		qos_txn_free(txn);
+		qf->txn = NULL;
+	}
+
+	if (copy_to_user((void __user *)arg, &param, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		ret = -EFAULT;
+		goto err_i1;
+	}
+
+err_i1:
+	mutex_unlock(&qf->lock);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_txn_abort(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_file *qf = filp->private_data;
+
+	QOS_DBG("begin");
+
+	mutex_lock(&qf->lock);
+
+	if (qf->txn == NULL)
+		ret = -EINVAL;
+
+	qos_txn_free(qf->txn);
+	qf->txn = NULL;
+
+	mutex_unlock(&qf->lock);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_set_partition(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_file *qf = filp->private_data;
+	struct qos_ioc_partition_param param;
+	int num = DIV_ROUND_UP(rcar_qos_get_master_id_max() + 1, 64);
+
+	QOS_DBG("begin");
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (copy_from_user(&param, (void __user *)arg, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	if (param.map == NULL)
+		return rcar_qos_set_partition(param.uid, NULL);
+
+	mutex_lock(&qf->lock);
+
+	if (copy_from_user(qf->table, (void __user *)(param.map),
+			   num * sizeof(__u64))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		ret = -EFAULT;
+		goto err_i1;
+	}
+
+	ret = rcar_qos_set_partition(param.uid, qf->table);
+
+err_i1:
+	mutex_unlock(&qf->lock);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_group_commit(struct file *filp, unsigned long arg)
+{
+	int ret = 0;
+	struct qos_file *qf = filp->private_data;
+	struct qos_ioc_group_commit_param param;
+	int num = (rcar_qos_get_master_id_max() + 1) * 2;
+	__u64 *mask = qf->table;
+
+	QOS_DBG("begin");
+
+	if (copy_from_user(&param, (void __user *)arg, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	if (param.entries.num > num) {
+		pr_err("QoS(%s): too many entries[%u]\n", __func__,
+		       param.entries.num);
+		return -EINVAL;
+	}
+
+	mutex_lock(&qf->lock);
+
+	/* Allocated on first use and kept for the life of the file */
+	if (qf->ip_qos == NULL) {
+		qf->ip_qos = kmalloc_array(num, sizeof(*qf->ip_qos), GFP_KERNEL);
+		if (qf->ip_qos == NULL) {
+			ret = -ENOMEM;
+			goto err_i1;
+		}
+	}
+
+	if (copy_from_user(qf->ip_qos, (void __user *)(param.entries.ip_qos),
+			   param.entries.num * sizeof(*qf->ip_qos)) ||
+	    (param.entries.mask &&
+	     copy_from_user(mask, (void __user *)(param.entries.mask),
+			    param.entries.num * sizeof(*mask)))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		ret = -EFAULT;
+		goto err_i1;
+	}
+
+	ret = rcar_qos_check_partition(filp->f_cred, qf->ip_qos,
+				       param.entries.num);
+	if (ret)
+		goto err_i1;
+
+	ret = rcar_qos_group_commit(qf->ip_qos,
+				    param.entries.mask ? mask : NULL,
+				    param.entries.num,
+				    param.flags & QOS_GROUP_FLAG_NOWAIT,
+				    &param.seq, &param.exe_membank);
+	if (ret)
+		goto err_i1;
+
+	if (copy_to_user((void __user *)arg, &param, sizeof(param))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		ret = -EFAULT;
+		goto err_i1;
+	}
+
+err_i1:
+	mutex_unlock(&qf->lock);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+static int qos_set_group_window(struct file *filp, unsigned long arg)
+{
+	__u32 window_us;
+
+	QOS_DBG("begin");
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (copy_from_user(&window_us, (void __user *)arg,
+			   sizeof(window_us))) {
+		pr_err("QoS(%s): copy param error\n", __func__);
+		return -EFAULT;
+	}
+
+	QOS_DBG("end");
+
+	return rcar_qos_set_group_window(window_us);
+}
@@ -0,0 +1,288 @@
+/*************************************************************************/ /*
+ qos_firmware.c
+
+ Copyright (C) 2021 Renesas Electronics Corporation
+
+ License        Dual MIT/GPLv2
+
+ The contents of this file are subject to the MIT license as set out below.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ Alternatively, the contents of this file may be used under the terms of
+ the GNU General Public License Version 2 ("GPL") in which case the provisions
+ of GPL are applicable instead of those above.
+
+ If you wish to allow use of your version of this file only under the terms of
+ GPL, and not to allow others to use your version of this file under the terms
+ of the MIT license, indicate your decision by deleting the provisions above
+ and replace them with the notice and other provisions required by GPL as set
+ out in the file called "GPL-COPYING" included in this distribution. If you do
+ not delete the provisions above, a recipient may use your version of this file
+ under the terms of either the MIT license or GPL.
+
+ This License is also included in this distribution in the file called
+ "MIT-COPYING".
+
+ EXCEPT AS OTHERWISE STATED IN A NEGOTIATED AGREEMENT: (A) THE SOFTWARE IS
+ PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ PURPOSE AND NONINFRINGEMENT; AND (B) IN NO EVENT SHALL THE AUTHORS OR
+ COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+ GPLv2:
+ If you wish to use this file under the terms of GPL, following terms are
+ effective.
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; version 2 of the License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/ /*************************************************************************/
+
+#include <linux/device.h>
+#include <linux/firmware.h>
+#include <linux/crc32.h>
+#include <linux/slab.h>
+
+#include "qos_core.h"
+
+/* #define DEBUG */
+
+#ifdef DEBUG
+#define QOS_DBG(fmt, args...) \
+		printk("%s: " fmt "\n", __func__, ##args)
+#else
+#define QOS_DBG(fmt, args...) do { } while (0)
+#endif
+
+/*
+ * Check that every profile and entry of an image lies within @size, and
+ * that the profile to activate is one of them.
+ */
+static int qos_fw_check_profiles(const __u8 *data, size_t size)
+{
+	const struct qos_fw_header *hdr = (const struct qos_fw_header *)data;
+	int num = rcar_qos_get_master_id_max() + 1;
+	const struct qos_fw_profile *prof;
+	const struct qos_fw_entry *entry;
+	__u16 active_id = le16_to_cpu(hdr->active_id);
+	bool active_found = false;
+	size_t pos = sizeof(*hdr);
+	int entry_num;
+	int n, i;
+
+	for (n = 0; n < le16_to_cpu(hdr->profile_num); n++) {
+		if (size - pos < sizeof(*prof))
+			goto err_i1;
+		prof = (const struct qos_fw_profile *)(data + pos);
+		pos += sizeof(*prof);
+
+		if (le32_to_cpu(prof->id) >= QOS_PROFILE_NUM)
+			goto err_i1;
+		if (le32_to_cpu(prof->id) == active_id)
+			active_found = true;
+
+		entry_num = le16_to_cpu(prof->entry_num);
+		if ((size - pos) / sizeof(*entry) < entry_num)
+			goto err_i1;
+		entry = (const struct qos_fw_entry *)(data + pos);
+		pos += entry_num * sizeof(*entry);
+
+		for (i = 0; i < entry_num; i++) {
+			if ((entry[i].qos_type > QOS_TYPE_BE) ||
+			    (le16_to_cpu(entry[i].master_id) >= num))
+				goto err_i1;
+		}
+	}
+
+	if (pos != size)
+		goto err_i1;
+
+	if ((active_id != QOS_FW_ACTIVE_NONE) && !active_found) {
+		pr_err("QoS(%s): active profile[%u] is not in the image\n",
+		       __func__, active_id);
+		return -EINVAL;
+	}
+
+	return 0;
+
+err_i1:
+	pr_err("QoS(%s): malformed profile[%d]\n", __func__, n);
+
+	return -EINVAL;
+}
+
+/* Check a whole image before anything in it is registered */
+static int qos_fw_check(const __u8 *data, size_t size)
+{
+	const struct qos_fw_header *hdr = (const struct qos_fw_header *)data;
+	__u32 product;
+	__u32 crc;
+
+	if ((size < sizeof(*hdr)) ||
+	    (le32_to_cpu(hdr->magic) != QOS_FW_MAGIC) ||
+	    (le32_to_cpu(hdr->size) != size)) {
+		pr_err("QoS(%s): not a profile image\n", __func__);
+		return -EINVAL;
+	}
+
+	if (le16_to_cpu(hdr->version) != QOS_FW_VERSION) {
+		pr_err("QoS(%s): unsupported image version[%u]\n", __func__,
+		       le16_to_cpu(hdr->version));
+		return -EINVAL;
+	}
+
+	crc = ~crc32_le(~0, data + offsetof(struct qos_fw_header, version),
+			size - offsetof(struct qos_fw_header, version));
+	if (crc != le32_to_cpu(hdr->checksum)) {
+		pr_err("QoS(%s): checksum error\n", __func__);
+		return -EBADMSG;
+	}
+
+	product = le32_to_cpu(hdr->product);
+	if ((le16_to_cpu(hdr->master_id_max) != rcar_qos_get_master_id_max()) ||
+	    (product && (product != rcar_qos_get_product()))) {
+		pr_err("QoS(%s): image is for another SoC\n", __func__);
+		return -ENODEV;
+	}
+
+	return qos_fw_check_profiles(data, size);
+}
+
+/*
+ * Register every profile of a checked image. All tables are built before
+ * any profile is installed, so on failure the registered profiles,
+ * including those the image would have replaced, are left as they were.
+ */
+static int qos_fw_register(const __u8 *data, size_t size)
+{
+	const struct qos_fw_header *hdr = (const struct qos_fw_header *)data;
+	int profile_num = le16_to_cpu(hdr->profile_num);
+	int num = rcar_qos_get_master_id_max() + 1;
+	const struct qos_fw_profile *prof;
+	const struct qos_fw_entry *entry;
+	size_t pos = sizeof(*hdr);
+	const char **name;
+	__u64 **table;
+	__u32 *id;
+	int entry_num;
+	int n, i;
+	int ret = 0;
+
+	id = kcalloc(profile_num, sizeof(*id), GFP_KERNEL);
+	name = kcalloc(profile_num, sizeof(*name), GFP_KERNEL);
+	table = kcalloc(profile_num, sizeof(*table), GFP_KERNEL);
+	if ((id == NULL) || (name == NULL) || (table == NULL)) {
+		ret = -ENOMEM;
+		goto err_i1;
+	}
+
+	for (n = 0; n < profile_num; n++) {
+		prof = (const struct qos_fw_profile *)(data + pos);
+		pos += sizeof(*prof);
+
+		entry_num = le16_to_cpu(prof->entry_num);
+		entry = (const struct qos_fw_entry *)(data + pos);
+		pos += entry_num * sizeof(*entry);
+
+		table[n] = kcalloc(num * 2, sizeof(**table), GFP_KERNEL);
+		if (table[n] == NULL) {
+			ret = -ENOMEM;
+			goto err_i2;
+		}
+		for (i = 0; i < entry_num; i++)
+			table[n][entry[i].qos_type * num +
+				 le16_to_cpu(entry[i].master_id)] =
+				le64_to_cpu(entry[i].qos);
+
+		id[n] = le32_to_cpu(prof->id);
+		name[n] = prof->name;
+
+		QOS_DBG("profile[%u] %.*s, %d entries", id[n],
+			QOS_PROFILE_NAME_LEN, prof->name, entry_num);
+	}
+
+	rcar_qos_install_profiles(id, name, table, profile_num);
+
+	kfree(table);
+	kfree(name);
+	kfree(id);
+
+	return 0;
+
+err_i2:
+	pr_err("QoS(%s): profile[%d] error[%d]\n", __func__, n, ret);
+
+	for (i = 0; i < n; i++)
+		kfree(table[i]);
+
+err_i1:
+	kfree(table);
+	kfree(name);
+	kfree(id);
+
+	return ret;
+}
+
+/*
+ * Register the profiles of QOS_FW_NAME and activate the default one, so
+ * that the tables are in place before user space runs. A missing image is
+ * not an error.
+ */
+int rcar_qos_load_firmware(struct device *dev)
+{
+	const struct firmware *fw;
+	const struct qos_fw_header *hdr;
+	__u16 active_id;
+	__u8 exe_membank;
+	int ret;
+
+	QOS_DBG("begin");
+
+	if (firmware_request_nowarn(&fw, QOS_FW_NAME, dev))
+		return 0;
+
+	ret = qos_fw_check(fw->data, fw->size);
+	if (ret)
+		goto err_i1;
+
+	ret = qos_fw_register(fw->data, fw->size);
+	if (ret)
+		goto err_i1;
+
+	hdr = (const struct qos_fw_header *)fw->data;
+	active_id = le16_to_cpu(hdr->active_id);
+	if (active_id != QOS_FW_ACTIVE_NONE) {
+		ret = rcar_qos_activate_profile(active_id, &exe_membank);
+		if (ret)
+			pr_err("QoS(%s): activate profile[%u] error[%d]\n",
+			       __func__, active_id, ret);
+	}
+
+err_i1:
+	release_firmware(fw);
+
+	QOS_DBG("end");
+
+	return ret;
+}
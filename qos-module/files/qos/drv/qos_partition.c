@@ -0,0 +1,436 @@
+/*************************************************************************/ /*
+ qos_partition.c
+
+ Copyright (C) 2021 Renesas Electronics Corporation
+
+ License        Dual MIT/GPLv2
+
+ The contents of this file are subject to the MIT license as set out below.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ Alternatively, the contents of this file may be used under the terms of
+ the GNU General Public License Version 2 ("GPL") in which case the provisions
+ of GPL are applicable instead of those above.
+
+ If you wish to allow use of your version of this file only under the terms of
+ GPL, and not to allow others to use your version of this file under the terms
+ of the MIT license, indicate your decision by deleting the provisions above
+ and replace them with the notice and other provisions required by GPL as set
+ out in the file called "GPL-COPYING" included in this distribution. If you do
+ not delete the provisions above, a recipient may use your version of this file
+ under the terms of either the MIT license or GPL.
+
+ This License is also included in this distribution in the file called
+ "MIT-COPYING".
+
+ EXCEPT AS OTHERWISE STATED IN A NEGOTIATED AGREEMENT: (A) THE SOFTWARE IS
+ PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ PURPOSE AND NONINFRINGEMENT; AND (B) IN NO EVENT SHALL THE AUTHORS OR
+ COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+ GPLv2:
+ If you wish to use this file under the terms of GPL, following terms are
+ effective.
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; version 2 of the License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/ /*************************************************************************/
+
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/kref.h>
+#include <linux/string.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/cred.h>
+#include <linux/uidgid.h>
+
+#include "qos_core.h"
+
+/* #define DEBUG */
+
+#ifdef DEBUG
+#define QOS_DBG(fmt, args...) \
+		printk("%s: " fmt "\n", __func__, ##args)
+#else
+#define QOS_DBG(fmt, args...) do { } while (0)
+#endif
+
+/*
+ * Master ID partitions. A client whose credentials match a partition may
+ * only write the master IDs set in its map; clients without a partition
+ * are not restricted.
+ */
+struct qos_partition {
+	kuid_t uid;
+	__u64 *map;		/* NULL when the slot is free */
+};
+
+static DEFINE_MUTEX(qos_partition_mutex);
+
+static struct qos_partition partitions[QOS_PARTITION_NUM];
+static int partition_num;
+
+#define QOS_PARTITION_MAP_NUM(__master_num)	DIV_ROUND_UP(__master_num, 64)
+
+static struct qos_partition *qos_partition_find(kuid_t uid)
+{
+	int i;
+
+	for (i = 0; i < QOS_PARTITION_NUM; i++) {
+		if (partitions[i].map && uid_eq(partitions[i].uid, uid))
+			return &partitions[i];
+	}
+
+	return NULL;
+}
+
+int rcar_qos_set_partition(__u32 uid, const __u64 *map)
+{
+	int master_num = rcar_qos_get_master_id_max() + 1;
+	size_t size = QOS_PARTITION_MAP_NUM(master_num) * sizeof(__u64);
+	kuid_t kuid = make_kuid(current_user_ns(), uid);
+	struct qos_partition *part;
+	__u64 *copy = NULL;
+	int ret = 0;
+	int i;
+
+	QOS_DBG("begin");
+
+	if (!uid_valid(kuid))
+		return -EINVAL;
+
+	if (map) {
+		copy = kmemdup(map, size, GFP_KERNEL);
+		if (copy == NULL)
+			return -ENOMEM;
+	}
+
+	mutex_lock(&qos_partition_mutex);
+
+	part = qos_partition_find(kuid);
+	if (part) {
+		kfree(part->map);
+		part->map = copy;
+		if (copy == NULL)
+			partition_num--;
+		goto err_i1;
+	}
+
+	if (copy == NULL) {
+		ret = -ENOENT;
+		goto err_i1;
+	}
+
+	for (i = 0; i < QOS_PARTITION_NUM; i++) {
+		if (partitions[i].map == NULL)
+			break;
+	}
+	if (i == QOS_PARTITION_NUM) {
+		kfree(copy);
+		ret = -ENOSPC;
+		goto err_i1;
+	}
+
+	partitions[i].uid = kuid;
+	partitions[i].map = copy;
+	partition_num++;
+
+err_i1:
+	mutex_unlock(&qos_partition_mutex);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+/*
+ * Check that @cred may write the master IDs of @ip_qos. A NULL @ip_qos
+ * stands for a whole-table write, which a confined client may not issue.
+ */
+int rcar_qos_check_partition(const struct cred *cred,
+			     const struct qos_ioc_set_ip_qos_param *ip_qos,
+			     __u32 num)
+{
+	struct qos_partition *part;
+	__u16 id;
+	int ret = 0;
+	__u32 i;
+
+	if (READ_ONCE(partition_num) == 0)
+		return 0;
+
+	mutex_lock(&qos_partition_mutex);
+
+	part = qos_partition_find(cred->euid);
+	if (part == NULL)
+		goto err_i1;
+
+	if (ip_qos == NULL) {
+		ret = -EPERM;
+		goto err_i1;
+	}
+
+	for (i = 0; i < num; i++) {
+		id = ip_qos[i].master_id;
+		if (id > rcar_qos_get_master_id_max()) {
+			ret = -EINVAL;
+			break;
+		}
+		if (!((part->map[id / 64] >> (id % 64)) & 1)) {
+			ret = -EPERM;
+			break;
+		}
+	}
+
+err_i1:
+	mutex_unlock(&qos_partition_mutex);
+
+	return ret;
+}
+
+/*
+ * Group commit. Entries submitted by every client during a window are
+ * merged into one set and committed by qos_group_work with a single
+ * standby program and bank switch. Windows are numbered from 1. Each
+ * window carries its own result, so a submitter still gets the outcome
+ * of the window it joined after later windows have been committed.
+ */
+struct qos_group_window {
+	struct kref ref;	/* held by qos_group_work and each waiter */
+	__u64 seq;
+	int result;
+	__u8 exe_membank;
+	bool done;
+};
+
+static DEFINE_MUTEX(qos_group_mutex);
+static DECLARE_WAIT_QUEUE_HEAD(qos_group_wq);
+static struct delayed_work qos_group_work;
+static bool group_init;
+static __u32 group_window_us = QOS_GROUP_WINDOW_US_DEFAULT;
+static __u64 group_seq = 1;
+
+/* The window being filled, NULL until the next submission opens one */
+static struct qos_group_window *group_window;
+
+/* Dense, indexed by type * (master_id_max + 1) + master_id */
+static __u64 *group_qos;
+static __u64 *group_mask;
+
+/* Compacted entries handed to the core, owned by qos_group_work */
+static struct qos_ioc_set_ip_qos_param *group_ip_qos;
+static __u64 *group_ip_mask;
+
+static void qos_group_window_release(struct kref *ref)
+{
+	kfree(container_of(ref, struct qos_group_window, ref));
+}
+
+static void qos_group_work_fn(struct work_struct *work)
+{
+	int master_num = rcar_qos_get_master_id_max() + 1;
+	struct qos_group_window *win;
+	__u8 exe_membank;
+	__u32 num = 0;
+	int ret;
+	int n;
+
+	mutex_lock(&qos_group_mutex);
+
+	for (n = 0; n < master_num * 2; n++) {
+		if (group_mask[n] == 0)
+			continue;
+		group_ip_qos[num].qos_type = n / master_num;
+		group_ip_qos[num].master_id = n % master_num;
+		group_ip_qos[num].qos = group_qos[n];
+		group_ip_mask[num] = group_mask[n];
+		group_mask[n] = 0;
+		num++;
+	}
+	win = group_window;
+	group_window = NULL;
+
+	mutex_unlock(&qos_group_mutex);
+
+	/*
+	 * The next window fills group_qos while this one is committed. The
+	 * entries are merged into the executing tables; while other clients
+	 * have entries staged the window fails with -EBUSY instead.
+	 */
+	ret = rcar_qos_apply_ip_qos(group_ip_qos, group_ip_mask, num,
+				    &exe_membank);
+	if (ret)
+		pr_err("QoS(%s): failed to rcar_qos_apply_ip_qos() errno=[%d]\n",
+		       __func__, ret);
+
+	win->result = ret;
+	win->exe_membank = exe_membank;
+	smp_store_release(&win->done, true);
+
+	wake_up_all(&qos_group_wq);
+	kref_put(&win->ref, qos_group_window_release);
+}
+
+static int qos_group_alloc(int master_num)
+{
+	if (group_init)
+		return 0;
+
+	group_qos = kcalloc(master_num * 2, sizeof(__u64), GFP_KERNEL);
+	group_mask = kcalloc(master_num * 2, sizeof(__u64), GFP_KERNEL);
+	group_ip_qos = kcalloc(master_num * 2, sizeof(*group_ip_qos),
+			       GFP_KERNEL);
+	group_ip_mask = kcalloc(master_num * 2, sizeof(__u64), GFP_KERNEL);
+	if ((group_qos == NULL) || (group_mask == NULL) ||
+	    (group_ip_qos == NULL) || (group_ip_mask == NULL)) {
+		kfree(group_qos);
+		kfree(group_mask);
+		kfree(group_ip_qos);
+		kfree(group_ip_mask);
+		return -ENOMEM;
+	}
+
+	INIT_DELAYED_WORK(&qos_group_work, qos_group_work_fn);
+	group_init = true;
+
+	return 0;
+}
+
+int rcar_qos_set_group_window(__u32 window_us)
+{
+	mutex_lock(&qos_group_mutex);
+	group_window_us = window_us;
+	mutex_unlock(&qos_group_mutex);
+
+	return 0;
+}
+
+/*
+ * Add entries to the current window, opening it if needed. Unless @nowait
+ * is set, wait for the window to be committed and return its result.
+ * The window joined is returned in @seq.
+ */
+int rcar_qos_group_commit(const struct qos_ioc_set_ip_qos_param *ip_qos,
+			  const __u64 *mask, __u32 num, bool nowait,
+			  __u64 *seq, __u8 *exe_membank)
+{
+	int master_num = rcar_qos_get_master_id_max() + 1;
+	struct qos_group_window *win;
+	__u64 m;
+	__u32 i;
+	int ret;
+	int n;
+
+	QOS_DBG("begin");
+
+	for (i = 0; i < num; i++) {
+		if ((ip_qos[i].qos_type > QOS_TYPE_BE) ||
+		    (ip_qos[i].master_id >= master_num))
+			return -EINVAL;
+	}
+
+	mutex_lock(&qos_group_mutex);
+
+	ret = qos_group_alloc(master_num);
+	if (ret)
+		goto err_i1;
+
+	if (group_window == NULL) {
+		win = kzalloc(sizeof(*win), GFP_KERNEL);
+		if (win == NULL) {
+			ret = -ENOMEM;
+			goto err_i1;
+		}
+		kref_init(&win->ref);
+		win->seq = group_seq++;
+		group_window = win;
+		schedule_delayed_work(&qos_group_work,
+				      usecs_to_jiffies(group_window_us));
+	}
+	win = group_window;
+
+	for (i = 0; i < num; i++) {
+		n = ip_qos[i].qos_type * master_num + ip_qos[i].master_id;
+		m = mask ? mask[i] : ~0ULL;
+		group_qos[n] = (group_qos[n] & ~m) | (ip_qos[i].qos & m);
+		group_mask[n] |= m;
+	}
+
+	*seq = win->seq;
+	if (!nowait)
+		kref_get(&win->ref);
+
+	mutex_unlock(&qos_group_mutex);
+
+	if (nowait)
+		return 0;
+
+	ret = wait_event_interruptible(qos_group_wq,
+				       smp_load_acquire(&win->done));
+	if (!ret) {
+		ret = win->result;
+		*exe_membank = win->exe_membank;
+	}
+	kref_put(&win->ref, qos_group_window_release);
+
+	QOS_DBG("end");
+
+	return ret;
+
+err_i1:
+	mutex_unlock(&qos_group_mutex);
+
+	return ret;
+}
+
+void rcar_qos_partition_exit(void)
+{
+	int i;
+
+	if (group_init) {
+		/* A window the work never ran for has no waiters left */
+		cancel_delayed_work_sync(&qos_group_work);
+		kfree(group_window);
+		group_window = NULL;
+		kfree(group_qos);
+		kfree(group_mask);
+		kfree(group_ip_qos);
+		kfree(group_ip_mask);
+		group_init = false;
+	}
+
+	mutex_lock(&qos_partition_mutex);
+
+	for (i = 0; i < QOS_PARTITION_NUM; i++) {
+		kfree(partitions[i].map);
+		partitions[i].map = NULL;
+	}
+	partition_num = 0;
+
+	mutex_unlock(&qos_partition_mutex);
+}
@@ -0,0 +1,245 @@
+/*************************************************************************/ /*
+ qos_profile.c
+
+ Copyright (C) 2021 Renesas Electronics Corporation
+
+ License        Dual MIT/GPLv2
+
+ The contents of this file are subject to the MIT license as set out below.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ Alternatively, the contents of this file may be used under the terms of
+ the GNU General Public License Version 2 ("GPL") in which case the provisions
+ of GPL are applicable instead of those above.
+
+ If you wish to allow use of your version of this file only under the terms of
+ GPL, and not to allow others to use your version of this file under the terms
+ of the MIT license, indicate your decision by deleting the provisions above
+ and replace them with the notice and other provisions required by GPL as set
+ out in the file called "GPL-COPYING" included in this distribution. If you do
+ not delete the provisions above, a recipient may use your version of this file
+ under the terms of either the MIT license or GPL.
+
+ This License is also included in this distribution in the file called
+ "MIT-COPYING".
+
+ EXCEPT AS OTHERWISE STATED IN A NEGOTIATED AGREEMENT: (A) THE SOFTWARE IS
+ PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ PURPOSE AND NONINFRINGEMENT; AND (B) IN NO EVENT SHALL THE AUTHORS OR
+ COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+ GPLv2:
+ If you wish to use this file under the terms of GPL, following terms are
+ effective.
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; version 2 of the License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/ /*************************************************************************/
+
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "qos_core.h"
+
+/* #define DEBUG */
+
+#ifdef DEBUG
+#define QOS_DBG(fmt, args...) \
+		printk("%s: " fmt "\n", __func__, ##args)
+#else
+#define QOS_DBG(fmt, args...) do { } while (0)
+#endif
+
+/*
+ * Profiles registered once by user space and activated by ID. Each one
+ * holds a FIX and a BE table of master_id_max + 1 entries, back to back.
+ */
+struct qos_profile {
+	char name[QOS_PROFILE_NAME_LEN];
+	__u64 *table;
+};
+
+static DEFINE_MUTEX(qos_profile_mutex);
+
+static struct qos_profile profiles[QOS_PROFILE_NUM];
+
+int rcar_qos_register_profile(__u32 id, const char *name,
+			      const __u64 *fix_qos, const __u64 *be_qos)
+{
+	int num = rcar_qos_get_master_id_max() + 1;
+	__u64 *table;
+
+	QOS_DBG("begin");
+
+	if (id >= QOS_PROFILE_NUM)
+		return -EINVAL;
+
+	table = kmalloc_array(num * 2, sizeof(__u64), GFP_KERNEL);
+	if (table == NULL)
+		return -ENOMEM;
+
+	memcpy(table, fix_qos, num * sizeof(__u64));
+	memcpy(table + num, be_qos, num * sizeof(__u64));
+
+	mutex_lock(&qos_profile_mutex);
+
+	kfree(profiles[id].table);
+	profiles[id].table = table;
+	strscpy(profiles[id].name, name, QOS_PROFILE_NAME_LEN);
+
+	mutex_unlock(&qos_profile_mutex);
+
+	QOS_DBG("end");
+
+	return 0;
+}
+
+/*
+ * Install @num profiles in one step, replacing those registered under the
+ * same IDs. Each table holds the FIX and BE tables back to back, comes from
+ * kmalloc() and belongs to the store from then on. The IDs must have been
+ * checked already, so a set is never installed partly.
+ */
+void rcar_qos_install_profiles(const __u32 *id, const char * const *name,
+			       __u64 * const *table, int num)
+{
+	int i;
+
+	QOS_DBG("begin");
+
+	mutex_lock(&qos_profile_mutex);
+
+	for (i = 0; i < num; i++) {
+		kfree(profiles[id[i]].table);
+		profiles[id[i]].table = table[i];
+		strscpy(profiles[id[i]].name, name[i], QOS_PROFILE_NAME_LEN);
+	}
+
+	mutex_unlock(&qos_profile_mutex);
+
+	QOS_DBG("end");
+}
+
+int rcar_qos_unregister_profile(__u32 id)
+{
+	int ret = 0;
+
+	QOS_DBG("begin");
+
+	if (id >= QOS_PROFILE_NUM)
+		return -EINVAL;
+
+	mutex_lock(&qos_profile_mutex);
+
+	if (profiles[id].table == NULL) {
+		ret = -ENOENT;
+	} else {
+		kfree(profiles[id].table);
+		profiles[id].table = NULL;
+		profiles[id].name[0] = '\0';
+	}
+
+	mutex_unlock(&qos_profile_mutex);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+/* Record the executing tables as the QOS_PROFILE_ID_HW_DEFAULT profile */
+int rcar_qos_register_hw_profile(void)
+{
+	int num = rcar_qos_get_master_id_max() + 1;
+	__u64 *table;
+	int ret;
+
+	QOS_DBG("begin");
+
+	table = kmalloc_array(num * 2, sizeof(__u64), GFP_KERNEL);
+	if (table == NULL)
+		return -ENOMEM;
+
+	ret = rcar_qos_get_all_qos(table, table + num, QOS_MEMBANK_EXE, 0);
+	if (!ret)
+		ret = rcar_qos_register_profile(QOS_PROFILE_ID_HW_DEFAULT,
+						QOS_PROFILE_NAME_HW_DEFAULT,
+						table, table + num);
+
+	kfree(table);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+/*
+ * Program the differences between a profile and the standby bank, then
+ * switch to it. No table crosses the user boundary on this path.
+ */
+int rcar_qos_activate_profile(__u32 id, __u8 *exe_membank)
+{
+	int num = rcar_qos_get_master_id_max() + 1;
+	int ret;
+
+	QOS_DBG("begin");
+
+	if (id >= QOS_PROFILE_NUM)
+		return -EINVAL;
+
+	mutex_lock(&qos_profile_mutex);
+
+	if (profiles[id].table == NULL) {
+		ret = -ENOENT;
+		goto err_i1;
+	}
+
+	ret = rcar_qos_commit_qos_table(profiles[id].table,
+					profiles[id].table + num,
+					num, exe_membank);
+
+err_i1:
+	mutex_unlock(&qos_profile_mutex);
+
+	QOS_DBG("end");
+
+	return ret;
+}
+
+void rcar_qos_profile_exit(void)
+{
+	int i;
+
+	mutex_lock(&qos_profile_mutex);
+
+	for (i = 0; i < QOS_PROFILE_NUM; i++) {
+		kfree(profiles[i].table);
+		profiles[i].table = NULL;
+		profiles[i].name[0] = '\0';
+	}
+
+	mutex_unlock(&qos_profile_mutex);
+}
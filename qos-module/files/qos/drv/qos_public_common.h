@@ -74,9 +74,18 @@ enum {
 	QOS_TYPE_MAX
 };
 
+/* Read the hardware instead of the driver's cached state */
+#define QOS_GET_FLAG_HW			0x01
+
+/* membank selectors other than an explicit bank 0 or 1 */
+#define QOS_MEMBANK_EXE			0xFE
+#define QOS_MEMBANK_STANDBY		0xFF
+
 struct qos_ioc_get_status_param {
-	__u8 statqen;
+	__u8 statqen;		/* not reported, always 0 */
 	__u8 exe_membank;
+	__u8 flags;
+	__u16 master_id_max;
 };
 
 struct qos_ioc_set_all_qos_param {
@@ -84,6 +93,28 @@ struct qos_ioc_set_all_qos_param {
 	__u8 *be_qos;
 };
 
+#define QOS_TABLE_FIX			0x01
+#define QOS_TABLE_BE			0x02
+#define QOS_TABLE_ALL			(QOS_TABLE_FIX | QOS_TABLE_BE)
+
+/*
+ * length is the number of bytes copied per table, a multiple of 8 up to
+ * (master_id_max + 1) * 8; 0 means the whole table. Entries past length
+ * keep their current standby value.
+ */
+struct qos_ioc_set_qos_table_param {
+	__u8 *fix_qos;
+	__u8 *be_qos;
+	__u32 length;
+	__u32 table_mask;
+};
+
+
+/* Stage a table as QOS_IOCTL_SET_QOS_TABLE does, then switch to it */
+struct qos_ioc_commit_qos_table_param {
+	struct qos_ioc_set_qos_table_param table;
+	__u8 exe_membank;
+};
 
 struct qos_ioc_set_ip_qos_param {
 	__u8 qos_type;
@@ -91,11 +122,178 @@ struct qos_ioc_set_ip_qos_param {
 	__u64 qos;
 };
 
+/*
+ * Sparse update of the standby bank. When mask is not NULL it holds one
+ * bit-mask per entry, and only the masked bits of ip_qos[n].qos are written.
+ */
+struct qos_ioc_set_multi_ip_qos_param {
+	struct qos_ioc_set_ip_qos_param *ip_qos;
+	__u64 *mask;
+	__u32 num;
+};
+
 struct qos_ioc_get_ip_qos_param {
 	__u8 qos_type;
 	__u16 master_id;
 	__u8 membank;
 	__u64 qos;
+	__u8 flags;
+};
+
+/* Buffers must hold (master_id_max + 1) entries of 8 bytes each */
+struct qos_ioc_get_all_qos_param {
+	__u8 *fix_qos;
+	__u8 *be_qos;
+	__u8 membank;
+	__u8 flags;
+};
+
+/*
+ * Layout of the per-open staging area mapped by mmap() at offset 0.
+ * Each table holds (master_id_max + 1) entries of 8 bytes.
+ */
+#define QOS_STAGING_FIX_OFFSET		0x00000000
+#define QOS_STAGING_BE_OFFSET		0x00001000
+#define QOS_STAGING_SIZE		0x00002000
+
+#define QOS_SWITCH_STATE_IDLE		0
+#define QOS_SWITCH_STATE_PENDING	1
+#define QOS_SWITCH_STATE_ARMED		2
+
+/*
+ * State of the asynchronous bank switch. seq is the sequence number of the
+ * last finished switch, as returned by QOS_IOCTL_SWITCH_MEMBANK_ASYNC or
+ * QOS_IOCTL_SCHEDULE_SWITCH; the timestamps are CLOCK_MONOTONIC
+ * nanoseconds, kick_ns being when QOSCTRL_MEMBANK was actually written.
+ */
+struct qos_ioc_switch_status_param {
+	__u64 seq;
+	__u64 deadline_ns;
+	__u64 kick_ns;
+	__u64 done_ns;
+	__s32 result;
+	__u8 state;
+	__u8 exe_membank;
+};
+
+/* Switch banks at the CLOCK_MONOTONIC time deadline_ns */
+struct qos_ioc_schedule_switch_param {
+	__u64 deadline_ns;
+	__u64 seq;
+};
+
+#define QOS_PROFILE_NUM			16
+#define QOS_PROFILE_NAME_LEN		16
+
+/* Each table holds (master_id_max + 1) entries of 8 bytes */
+struct qos_ioc_register_profile_param {
+	__u8 *fix_qos;
+	__u8 *be_qos;
+	__u32 id;
+	char name[QOS_PROFILE_NAME_LEN];
+};
+
+struct qos_ioc_activate_profile_param {
+	__u32 id;
+	__u8 exe_membank;
+};
+
+/*
+ * Loaded with warm_attach=1, the driver registers the executing tables it
+ * found as this profile, so that QOS_IOCTL_ACTIVATE_PROFILE restores them.
+ */
+#define QOS_PROFILE_ID_HW_DEFAULT	(QOS_PROFILE_NUM - 1)
+#define QOS_PROFILE_NAME_HW_DEFAULT	"hw_default"
+
+/*
+ * Profile image loaded with request_firmware() when the driver loads.
+ * Little endian: a header, then profile_num profiles, each followed by
+ * entry_num entries. Masters without an entry are programmed to 0.
+ * checksum is the CRC-32 (as computed by zlib) of the image from the
+ * version field on. The profile active_id, QOS_FW_ACTIVE_NONE or the ID
+ * of a profile in the image, is activated once all of them are registered.
+ */
+#define QOS_FW_NAME			"rcar_qos.bin"
+#define QOS_FW_MAGIC			0x31534f51	/* "QOS1" */
+#define QOS_FW_VERSION			1
+#define QOS_FW_ACTIVE_NONE		0xFFFF
+
+struct qos_fw_header {
+	__le32 magic;
+	__le32 checksum;
+	__le16 version;
+	__le16 master_id_max;
+	__le32 product;		/* PRR product ID, 0 for any SoC */
+	__le32 size;		/* of the whole image */
+	__le16 profile_num;
+	__le16 active_id;
+};
+
+struct qos_fw_profile {
+	__le32 id;
+	__le16 entry_num;
+	__le16 reserved;
+	char name[QOS_PROFILE_NAME_LEN];
+};
+
+struct qos_fw_entry {
+	__le64 qos;
+	__le16 master_id;
+	__u8 qos_type;
+	__u8 reserved[5];
+};
+
+/*
+ * Per-open transaction. QOS_IOCTL_TXN_BEGIN returns the commit generation
+ * it started from, QOS_IOCTL_TXN_SET records entries in the transaction
+ * only (with the same masking as QOS_IOCTL_SET_MULTI_IP_QOS), and
+ * QOS_IOCTL_TXN_COMMIT applies them on top of the executing tables and
+ * switches banks. Entries changed by another commit since the transaction
+ * began are conflicts: they fail the commit with EAGAIN unless
+ * QOS_TXN_FLAG_MERGE is set, in which case only the masked bits are
+ * applied over the newer value. conflicts is returned in both cases.
+ * While entries another client has staged are waiting for a switch, the
+ * commit fails with EBUSY rather than drop them. A transaction stays open until a commit succeeds; committing an
+ * empty one just closes it.
+ */
+#define QOS_TXN_FLAG_MERGE		0x01
+
+struct qos_ioc_txn_commit_param {
+	__u32 flags;
+	__u32 conflicts;
+	__u8 exe_membank;
+};
+
+#define QOS_PARTITION_NUM		16
+
+/*
+ * Confine clients whose effective uid is uid to the master IDs set in map,
+ * DIV_ROUND_UP(master_id_max + 1, 64) words with master ID n at bit n % 64
+ * of word n / 64. Confined clients cannot write whole tables, switch
+ * banks or manage profiles. A NULL map removes the partition.
+ * Requires CAP_SYS_ADMIN.
+ */
+struct qos_ioc_partition_param {
+	__u64 *map;
+	__u32 uid;
+};
+
+/*
+ * Group commit. Entries from every client submitted within one window,
+ * QOS_GROUP_WINDOW_US_DEFAULT unless changed by QOS_IOCTL_SET_GROUP_WINDOW,
+ * are committed together with a single bank switch. seq returns the window
+ * joined; without QOS_GROUP_FLAG_NOWAIT the call waits for its commit.
+ * Like QOS_IOCTL_TXN_COMMIT, a window fails with EBUSY while entries staged
+ * by another client are waiting for a switch.
+ */
+#define QOS_GROUP_FLAG_NOWAIT		0x01
+#define QOS_GROUP_WINDOW_US_DEFAULT	1000
+
+struct qos_ioc_group_commit_param {
+	struct qos_ioc_set_multi_ip_qos_param entries;
+	__u64 seq;
+	__u32 flags;
+	__u8 exe_membank;
 };
 
 #define QOS_IOCTL_BASE			'q'
@@ -104,11 +302,63 @@ struct qos_ioc_get_ip_qos_param {
 #define QOS_IOW(nr, type)		_IOW(QOS_IOCTL_BASE, nr, type)
 #define QOS_IOWR(nr, type)		_IOWR(QOS_IOCTL_BASE, nr, type)
 
+#define QOS_IOCTL_SET_IP_QOS	\
+		QOS_IOW(0x00, struct qos_ioc_set_ip_qos_param)
 #define QOS_IOCTL_SET_ALL_QOS	\
 		QOS_IOW(0x01, struct qos_ioc_set_all_qos_param)
+#define QOS_IOCTL_GET_IP_QOS	\
+		QOS_IOWR(0x02, struct qos_ioc_get_ip_qos_param)
 #define QOS_IOCTL_SWITCH_MEMBANK	\
 		QOS_IO(0x03)
+#define QOS_IOCTL_GET_STATUS	\
+		QOS_IOWR(0x04, struct qos_ioc_get_status_param)
+#define QOS_IOCTL_SET_MULTI_IP_QOS	\
+		QOS_IOW(0x05, struct qos_ioc_set_multi_ip_qos_param)
+#define QOS_IOCTL_GET_ALL_QOS	\
+		QOS_IOW(0x06, struct qos_ioc_get_all_qos_param)
+#define QOS_IOCTL_COMMIT_STAGING	\
+		QOS_IO(0x07)
+#define QOS_IOCTL_SET_QOS_TABLE	\
+		QOS_IOW(0x08, struct qos_ioc_set_qos_table_param)
+#define QOS_IOCTL_COMMIT_QOS_TABLE	\
+		QOS_IOWR(0x09, struct qos_ioc_commit_qos_table_param)
+#define QOS_IOCTL_SWITCH_MEMBANK_ASYNC	\
+		QOS_IOR(0x0A, __u64)
+#define QOS_IOCTL_GET_SWITCH_STATUS	\
+		QOS_IOR(0x0B, struct qos_ioc_switch_status_param)
+#define QOS_IOCTL_SET_SWITCH_EVENTFD	\
+		QOS_IOW(0x0C, __s32)
+#define QOS_IOCTL_SCHEDULE_SWITCH	\
+		QOS_IOWR(0x0D, struct qos_ioc_schedule_switch_param)
+#define QOS_IOCTL_CANCEL_SWITCH	\
+		QOS_IO(0x0E)
+#define QOS_IOCTL_REGISTER_PROFILE	\
+		QOS_IOW(0x0F, struct qos_ioc_register_profile_param)
+#define QOS_IOCTL_UNREGISTER_PROFILE	\
+		QOS_IOW(0x10, __u32)
+#define QOS_IOCTL_ACTIVATE_PROFILE	\
+		QOS_IOWR(0x11, struct qos_ioc_activate_profile_param)
+
+/* 0x12 to 0x19 are reserved */
+
+#define QOS_IOCTL_TXN_BEGIN	\
+		QOS_IOR(0x1A, __u64)
+#define QOS_IOCTL_TXN_SET	\
+		QOS_IOW(0x1B, struct qos_ioc_set_multi_ip_qos_param)
+#define QOS_IOCTL_TXN_COMMIT	\
+		QOS_IOWR(0x1C, struct qos_ioc_txn_commit_param)
+#define QOS_IOCTL_TXN_ABORT	\
+		QOS_IO(0x1D)
+
+#define QOS_IOCTL_SET_PARTITION	\
+		QOS_IOW(0x1E, struct qos_ioc_partition_param)
+#define QOS_IOCTL_GROUP_COMMIT	\
+		QOS_IOWR(0x1F, struct qos_ioc_group_commit_param)
+#define QOS_IOCTL_SET_GROUP_WINDOW	\
+		QOS_IOW(0x20, __u32)
+
+#define QOS_IOCTL_MAX_NR		0x21
 
-#define QOS_IOCTL_MAX_NR		0x04
+#define QOS_MULTI_IP_QOS_NUM_MAX	1024
 
 #endif /* __QOSPUBLIC_COMMON_H__ */
@@ -118,4 +118,51 @@
 
 #define ES30				(0x00000020U)
 
+#include "qos_stats.h"
+
+#ifndef readq
+#define readq(addr) (readl(addr) | (((__u64) readl((addr) + 4)) << 32))
+#endif
+
+#ifndef writeq
+#define writeq(val, addr) do { \
+	writel((__u32) (val), (addr)); \
+	writel((__u32) ((val) >> 32), (addr) + 4); \
+} while (0)
+#endif
+
+#ifndef readq_relaxed
+#define readq_relaxed(addr) (readl_relaxed(addr) | \
+			     (((__u64) readl_relaxed((addr) + 4)) << 32))
+#endif
+
+#ifndef writeq_relaxed
+#define writeq_relaxed(val, addr) do { \
+	writel_relaxed((__u32) (val), (addr)); \
+	writel_relaxed((__u32) ((val) >> 32), (addr) + 4); \
+} while (0)
+#endif
+
+#define READ_REG32(address) \
+	(qos_stats_inc(QOS_STAT_MMIO_READ), readl(address))
+#define READ_REG64(address) \
+	(qos_stats_inc(QOS_STAT_MMIO_READ), readq(address))
+#define WRITE_REG32(value, address) do { \
+	qos_stats_inc(QOS_STAT_MMIO_WRITE); \
+	writel(value, address); \
+} while (0)
+#define WRITE_REG64(value, address) do { \
+	qos_stats_inc(QOS_STAT_MMIO_WRITE); \
+	writeq(value, address); \
+} while (0)
+
+#define QOS_BANK_OFF(__index) (QOS_BANK_SIZE * (__index))
+
+/* Tables are laid out by type in bits [15:13] and bank in bit [12] */
+#define QOS_TYPE_BANK_OFF(__type, __bank) \
+	((((__type) << 13) & 0x0000E000) | (((__bank) << 12) & 0x00001000))
+
+extern uint32_t qos_base;				// Physical address of QoS module
+extern void __iomem *qos_reg_base;		// Vitural address of QoS module
+
 #endif /* __QOS_REG_H__ */
@@ -0,0 +1,171 @@
+/*************************************************************************/ /*
+ qos_stats.c
+
+ Copyright (C) 2021 Renesas Electronics Corporation
+
+ License        Dual MIT/GPLv2
+
+ The contents of this file are subject to the MIT license as set out below.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ Alternatively, the contents of this file may be used under the terms of
+ the GNU General Public License Version 2 ("GPL") in which case the provisions
+ of GPL are applicable instead of those above.
+
+ If you wish to allow use of your version of this file only under the terms of
+ GPL, and not to allow others to use your version of this file under the terms
+ of the MIT license, indicate your decision by deleting the provisions above
+ and replace them with the notice and other provisions required by GPL as set
+ out in the file called "GPL-COPYING" included in this distribution. If you do
+ not delete the provisions above, a recipient may use your version of this file
+ under the terms of either the MIT license or GPL.
+
+ This License is also included in this distribution in the file called
+ "MIT-COPYING".
+
+ EXCEPT AS OTHERWISE STATED IN A NEGOTIATED AGREEMENT: (A) THE SOFTWARE IS
+ PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ PURPOSE AND NONINFRINGEMENT; AND (B) IN NO EVENT SHALL THE AUTHORS OR
+ COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+ GPLv2:
+ If you wish to use this file under the terms of GPL, following terms are
+ effective.
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; version 2 of the License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/ /*************************************************************************/
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/fs.h>
+#include <linux/string.h>
+
+#include "qos_core.h"
+#include "qos_stats.h"
+
+/*
+ * Statistics are kept per CPU so that the register accessors can count
+ * from any context without a shared cache line, and are summed on read.
+ * A reset racing with an update may lose that one update.
+ */
+DEFINE_PER_CPU(struct qos_stats, qos_stats);
+
+static struct dentry *qos_debugfs_dir;
+
+static const char * const qos_stat_names[QOS_STAT_NUM] = {
+	[QOS_STAT_SET_ALL_QOS] = "set_all_qos",
+	[QOS_STAT_COMMIT_STAGING] = "commit_staging",
+	[QOS_STAT_SWITCH] = "switch",
+	[QOS_STAT_SWITCH_TIMEOUT] = "switch_timeout",
+	[QOS_STAT_SWITCH_COALESCED] = "switch_coalesced",
+	[QOS_STAT_MMIO_READ] = "mmio_read",
+	[QOS_STAT_MMIO_WRITE] = "mmio_write",
+};
+
+static const char * const qos_hist_names[QOS_HIST_NUM] = {
+	[QOS_HIST_SWITCH_POLL] = "switch_poll",
+	[QOS_HIST_MUTEX_WAIT_NS] = "mutex_wait_ns",
+	[QOS_HIST_STAGE_NS] = "stage_ns",
+	[QOS_HIST_SWITCH_NS] = "switch_ns",
+};
+
+static int qos_stats_show(struct seq_file *m, void *v)
+{
+	struct qos_stats *stats;
+	u64 sum;
+	int cpu;
+	int i;
+	int j;
+
+	for (i = 0; i < QOS_STAT_NUM; i++) {
+		sum = 0;
+		for_each_possible_cpu(cpu)
+			sum += per_cpu_ptr(&qos_stats, cpu)->count[i];
+		seq_printf(m, "%s: %llu\n", qos_stat_names[i], sum);
+	}
+
+	for (i = 0; i < QOS_HIST_NUM; i++) {
+		seq_printf(m, "\n%s:\n", qos_hist_names[i]);
+		for (j = 0; j < QOS_HIST_BUCKET_NUM; j++) {
+			sum = 0;
+			for_each_possible_cpu(cpu) {
+				stats = per_cpu_ptr(&qos_stats, cpu);
+				sum += stats->hist[i][j];
+			}
+			if (sum == 0)
+				continue;
+			if (j == QOS_HIST_BUCKET_NUM - 1)
+				seq_printf(m, "  >= %llu: %llu\n",
+					   1ULL << (j - 1), sum);
+			else
+				seq_printf(m, "  < %llu: %llu\n",
+					   1ULL << j, sum);
+		}
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(qos_stats);
+
+/* Any write clears every counter and histogram */
+static ssize_t qos_stats_reset_write(struct file *file,
+				     const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&qos_stats, cpu), 0,
+		       sizeof(struct qos_stats));
+
+	return count;
+}
+
+static const struct file_operations qos_stats_reset_fops = {
+	.owner = THIS_MODULE,
+	.write = qos_stats_reset_write,
+};
+
+int rcar_qos_stats_init(void)
+{
+	qos_debugfs_dir = debugfs_create_dir(QOS_DEVICE_NAME, NULL);
+	if (IS_ERR_OR_NULL(qos_debugfs_dir))
+		return -ENODEV;
+
+	debugfs_create_file("stats", 0444, qos_debugfs_dir, NULL,
+			    &qos_stats_fops);
+	debugfs_create_file("reset", 0200, qos_debugfs_dir, NULL,
+			    &qos_stats_reset_fops);
+
+	return 0;
+}
+
+void rcar_qos_stats_exit(void)
+{
+	debugfs_remove_recursive(qos_debugfs_dir);
+	qos_debugfs_dir = NULL;
+}
@@ -0,0 +1,154 @@
+/*************************************************************************/ /*
+ qos_stats.h
+
+ Copyright (C) 2021 Renesas Electronics Corporation
+
+ License        Dual MIT/GPLv2
+
+ The contents of this file are subject to the MIT license as set out below.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ Alternatively, the contents of this file may be used under the terms of
+ the GNU General Public License Version 2 ("GPL") in which case the provisions
+ of GPL are applicable instead of those above.
+
+ If you wish to allow use of your version of this file only under the terms of
+ GPL, and not to allow others to use your version of this file under the terms
+ of the MIT license, indicate your decision by deleting the provisions above
+ and replace them with the notice and other provisions required by GPL as set
+ out in the file called "GPL-COPYING" included in this distribution. If you do
+ not delete the provisions above, a recipient may use your version of this file
+ under the terms of either the MIT license or GPL.
+
+ This License is also included in this distribution in the file called
+ "MIT-COPYING".
+
+ EXCEPT AS OTHERWISE STATED IN A NEGOTIATED AGREEMENT: (A) THE SOFTWARE IS
+ PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ PURPOSE AND NONINFRINGEMENT; AND (B) IN NO EVENT SHALL THE AUTHORS OR
+ COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+ GPLv2:
+ If you wish to use this file under the terms of GPL, following terms are
+ effective.
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; version 2 of the License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/ /*************************************************************************/
+#ifndef __QOS_STATS_H__
+#define __QOS_STATS_H__
+
+#include <linux/percpu.h>
+#include <linux/bitops.h>
+#include <linux/ktime.h>
+
+enum qos_stat {
+	QOS_STAT_SET_ALL_QOS,
+	QOS_STAT_COMMIT_STAGING,
+	QOS_STAT_SWITCH,
+	QOS_STAT_SWITCH_TIMEOUT,
+	QOS_STAT_SWITCH_COALESCED,
+	QOS_STAT_MMIO_READ,
+	QOS_STAT_MMIO_WRITE,
+	QOS_STAT_NUM
+};
+
+enum qos_hist {
+	QOS_HIST_SWITCH_POLL,		/* QOSCTRL_MEMBANK reads per switch */
+	QOS_HIST_MUTEX_WAIT_NS,
+	QOS_HIST_STAGE_NS,
+	QOS_HIST_SWITCH_NS,
+	QOS_HIST_NUM
+};
+
+/* Bucket n counts values in [2^(n-1), 2^n), bucket 0 counts zero */
+#define QOS_HIST_BUCKET_NUM	(32)
+
+struct qos_stats {
+	u64 count[QOS_STAT_NUM];
+	u64 hist[QOS_HIST_NUM][QOS_HIST_BUCKET_NUM];
+};
+
+/*
+ * Statistics are only built with QOS_STATS=y (see the Makefile). Otherwise
+ * every hook below compiles away, and qos_stats_ns() returns 0 so that the
+ * timestamps taken for the histograms cost nothing either.
+ */
+#ifdef QOS_STATS
+DECLARE_PER_CPU(struct qos_stats, qos_stats);
+
+static inline void qos_stats_inc(enum qos_stat stat)
+{
+	this_cpu_inc(qos_stats.count[stat]);
+}
+
+static inline void qos_stats_add(enum qos_stat stat, u64 value)
+{
+	this_cpu_add(qos_stats.count[stat], value);
+}
+
+static inline void qos_stats_hist(enum qos_hist hist, u64 value)
+{
+	this_cpu_inc(qos_stats.hist[hist][min_t(int, fls64(value),
+						QOS_HIST_BUCKET_NUM - 1)]);
+}
+
+static inline u64 qos_stats_ns(void)
+{
+	return ktime_get_ns();
+}
+
+int rcar_qos_stats_init(void);
+void rcar_qos_stats_exit(void);
+#else
+static inline void qos_stats_inc(enum qos_stat stat)
+{
+}
+
+static inline void qos_stats_add(enum qos_stat stat, u64 value)
+{
+}
+
+static inline void qos_stats_hist(enum qos_hist hist, u64 value)
+{
+}
+
+static inline u64 qos_stats_ns(void)
+{
+	return 0;
+}
+
+static inline int rcar_qos_stats_init(void)
+{
+	return 0;
+}
+
+static inline void rcar_qos_stats_exit(void)
+{
+}
+#endif
+
+#endif /* __QOS_STATS_H__ */
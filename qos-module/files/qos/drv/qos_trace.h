@@ -0,0 +1,233 @@
+/*************************************************************************/ /*
+ qos_trace.h
+
+ Copyright (C) 2021 Renesas Electronics Corporation
+
+ License        Dual MIT/GPLv2
+
+ The contents of this file are subject to the MIT license as set out below.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ Alternatively, the contents of this file may be used under the terms of
+ the GNU General Public License Version 2 ("GPL") in which case the provisions
+ of GPL are applicable instead of those above.
+
+ If you wish to allow use of your version of this file only under the terms of
+ GPL, and not to allow others to use your version of this file under the terms
+ of the MIT license, indicate your decision by deleting the provisions above
+ and replace them with the notice and other provisions required by GPL as set
+ out in the file called "GPL-COPYING" included in this distribution. If you do
+ not delete the provisions above, a recipient may use your version of this file
+ under the terms of either the MIT license or GPL.
+
+ This License is also included in this distribution in the file called
+ "MIT-COPYING".
+
+ EXCEPT AS OTHERWISE STATED IN A NEGOTIATED AGREEMENT: (A) THE SOFTWARE IS
+ PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ PURPOSE AND NONINFRINGEMENT; AND (B) IN NO EVENT SHALL THE AUTHORS OR
+ COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+ GPLv2:
+ If you wish to use this file under the terms of GPL, following terms are
+ effective.
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; version 2 of the License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/ /*************************************************************************/
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM qos
+
+#if !defined(__QOS_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __QOS_TRACE_H__
+
+#include <linux/tracepoint.h>
+
+#include "qos.h"
+
+TRACE_EVENT(qos_ioctl_enter,
+	TP_PROTO(unsigned int cmd),
+	TP_ARGS(cmd),
+	TP_STRUCT__entry(
+		__field(unsigned int, cmd)
+	),
+	TP_fast_assign(
+		__entry->cmd = cmd;
+	),
+	TP_printk("nr=0x%02x", _IOC_NR(__entry->cmd))
+);
+
+TRACE_EVENT(qos_ioctl_exit,
+	TP_PROTO(unsigned int cmd, int ret),
+	TP_ARGS(cmd, ret),
+	TP_STRUCT__entry(
+		__field(unsigned int, cmd)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->cmd = cmd;
+		__entry->ret = ret;
+	),
+	TP_printk("nr=0x%02x ret=%d", _IOC_NR(__entry->cmd), __entry->ret)
+);
+
+/* Table copied in from user space, before it is staged */
+TRACE_EVENT(qos_table_copy,
+	TP_PROTO(int num, size_t bytes),
+	TP_ARGS(num, bytes),
+	TP_STRUCT__entry(
+		__field(int, num)
+		__field(size_t, bytes)
+	),
+	TP_fast_assign(
+		__entry->num = num;
+		__entry->bytes = bytes;
+	),
+	TP_printk("num=%d bytes=%zu", __entry->num, __entry->bytes)
+);
+
+DECLARE_EVENT_CLASS(qos_bank_class,
+	TP_PROTO(int type, __u32 bank, int num, int written),
+	TP_ARGS(type, bank, num, written),
+	TP_STRUCT__entry(
+		__field(int, type)
+		__field(__u32, bank)
+		__field(int, num)
+		__field(int, written)
+	),
+	TP_fast_assign(
+		__entry->type = type;
+		__entry->bank = bank;
+		__entry->num = num;
+		__entry->written = written;
+	),
+	TP_printk("type=%s bank=%u num=%d written=%d",
+		  __entry->type == QOS_TYPE_FIX ? "FIX" : "BE",
+		  __entry->bank, __entry->num, __entry->written)
+);
+
+/* Entries compared against the shadow and entries actually written */
+DEFINE_EVENT(qos_bank_class, qos_bank_stage,
+	TP_PROTO(int type, __u32 bank, int num, int written),
+	TP_ARGS(type, bank, num, written)
+);
+
+/* Standby bank brought in line with the executing one after a switch */
+DEFINE_EVENT(qos_bank_class, qos_bank_resync,
+	TP_PROTO(int type, __u32 bank, int num, int written),
+	TP_ARGS(type, bank, num, written)
+);
+
+/* Shadow of a bank read back from the hardware */
+DEFINE_EVENT(qos_bank_class, qos_bank_sync,
+	TP_PROTO(int type, __u32 bank, int num, int written),
+	TP_ARGS(type, bank, num, written)
+);
+
+TRACE_EVENT(qos_membank_write,
+	TP_PROTO(__u32 value),
+	TP_ARGS(value),
+	TP_STRUCT__entry(
+		__field(__u32, value)
+	),
+	TP_fast_assign(
+		__entry->value = value;
+	),
+	TP_printk("value=0x%08x", __entry->value)
+);
+
+/* One read of QOSCTRL_MEMBANK while waiting for a switch to apply */
+TRACE_EVENT(qos_switch_poll,
+	TP_PROTO(__u32 memory_bank, int retry),
+	TP_ARGS(memory_bank, retry),
+	TP_STRUCT__entry(
+		__field(__u32, memory_bank)
+		__field(int, retry)
+	),
+	TP_fast_assign(
+		__entry->memory_bank = memory_bank;
+		__entry->retry = retry;
+	),
+	TP_printk("membank=0x%08x retry=%d",
+		  __entry->memory_bank, __entry->retry)
+);
+
+TRACE_EVENT(qos_switch_done,
+	TP_PROTO(__u64 seq, int result, __u64 kick_ns, __u64 done_ns),
+	TP_ARGS(seq, result, kick_ns, done_ns),
+	TP_STRUCT__entry(
+		__field(__u64, seq)
+		__field(int, result)
+		__field(__u64, kick_ns)
+		__field(__u64, done_ns)
+	),
+	TP_fast_assign(
+		__entry->seq = seq;
+		__entry->result = result;
+		__entry->kick_ns = kick_ns;
+		__entry->done_ns = done_ns;
+	),
+	TP_printk("seq=%llu result=%d latency_ns=%llu", __entry->seq,
+		  __entry->result, __entry->done_ns - __entry->kick_ns)
+);
+
+DECLARE_EVENT_CLASS(qos_sram_class,
+	TP_PROTO(__u32 fix_offset, __u32 be_offset, int num),
+	TP_ARGS(fix_offset, be_offset, num),
+	TP_STRUCT__entry(
+		__field(__u32, fix_offset)
+		__field(__u32, be_offset)
+		__field(int, num)
+	),
+	TP_fast_assign(
+		__entry->fix_offset = fix_offset;
+		__entry->be_offset = be_offset;
+		__entry->num = num;
+	),
+	TP_printk("fix=0x%04x be=0x%04x num=%d", __entry->fix_offset,
+		  __entry->be_offset, __entry->num)
+);
+
+/* Banks saved on suspend */
+DEFINE_EVENT(qos_sram_class, qos_sram_backup,
+	TP_PROTO(__u32 fix_offset, __u32 be_offset, int num),
+	TP_ARGS(fix_offset, be_offset, num)
+);
+
+/* Banks restored on resume */
+DEFINE_EVENT(qos_sram_class, qos_sram_reload,
+	TP_PROTO(__u32 fix_offset, __u32 be_offset, int num),
+	TP_ARGS(fix_offset, be_offset, num)
+);
+
+#endif /* __QOS_TRACE_H__ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE qos_trace
+#include <trace/define_trace.h>
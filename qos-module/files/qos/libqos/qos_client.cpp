@@ -0,0 +1,230 @@
+/*************************************************************************
+* qos_client.cpp
+*
+* Copyright (C) 2015-2017 Renesas Electronics Corporation
+*
+* License        Dual MIT/GPLv2
+*
+* The contents of this file are subject to the MIT license as set out below.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* Alternatively, the contents of this file may be used under the terms of
+* the GNU General Public License Version 2 ("GPL") in which case the provisions
+* of GPL are applicable instead of those above.
+*
+* If you wish to allow use of your version of this file only under the terms of
+* GPL, and not to allow others to use your version of this file under the terms
+* of the MIT license, indicate your decision by deleting the provisions above
+* and replace them with the notice and other provisions required by GPL as set
+* out in the file called "GPL-COPYING" included in this distribution. If you do
+* not delete the provisions above, a recipient may use your version of this file
+* under the terms of either the MIT license or GPL.
+*
+* This License is also included in this distribution in the file called
+* "MIT-COPYING".
+*
+* EXCEPT AS OTHERWISE STATED IN A NEGOTIATED AGREEMENT: (A) THE SOFTWARE IS
+* PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+* PURPOSE AND NONINFRINGEMENT; AND (B) IN NO EVENT SHALL THE AUTHORS OR
+* COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+* IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+* CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*
+* GPLv2:
+* If you wish to use this file under the terms of GPL, following terms are
+* effective.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*************************************************************************/
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "qos_client.hpp"
+
+namespace rcar_qos {
+
+Device::~Device()
+{
+	close();
+}
+
+Device::Device(Device &&other) noexcept
+	: fd_(other.fd_), master_num_(other.master_num_)
+{
+	other.fd_ = -1;
+	other.master_num_ = 0;
+}
+
+Device &Device::operator=(Device &&other) noexcept
+{
+	if (this != &other) {
+		close();
+		fd_ = other.fd_;
+		master_num_ = other.master_num_;
+		other.fd_ = -1;
+		other.master_num_ = 0;
+	}
+	return *this;
+}
+
+int Device::open(const char *path) noexcept
+{
+	struct qos_ioc_get_status_param status = {};
+	int ret;
+
+	close();
+
+	fd_ = ::open(path, O_RDWR | O_CLOEXEC);
+	if (fd_ < 0)
+		return -errno;
+
+	ret = get_status(&status);
+	if (ret) {
+		close();
+		return ret;
+	}
+	master_num_ = status.master_id_max + 1U;
+
+	return 0;
+}
+
+void Device::close() noexcept
+{
+	if (fd_ >= 0)
+		::close(fd_);
+	fd_ = -1;
+	master_num_ = 0;
+}
+
+int Device::ioctl(unsigned long request, void *arg) noexcept
+{
+	int ret;
+
+	if (fd_ < 0)
+		return -EBADF;
+
+	do {
+		ret = ::ioctl(fd_, request, arg);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret < 0 ? -errno : 0;
+}
+
+int Device::get_status(struct qos_ioc_get_status_param *status) noexcept
+{
+	return ioctl(QOS_IOCTL_GET_STATUS, status);
+}
+
+int Device::get_ip_qos(__u8 type, __u16 master_id,
+		       __u64 *qos, __u8 membank) noexcept
+{
+	struct qos_ioc_get_ip_qos_param param = {};
+	int ret;
+
+	param.qos_type = type;
+	param.master_id = master_id;
+	param.membank = membank;
+
+	ret = ioctl(QOS_IOCTL_GET_IP_QOS, &param);
+	if (!ret)
+		*qos = param.qos;
+
+	return ret;
+}
+
+int Device::set_ip_qos(__u8 type, __u16 master_id,
+		       __u64 qos) noexcept
+{
+	struct qos_ioc_set_ip_qos_param param = {};
+
+	param.qos_type = type;
+	param.master_id = master_id;
+	param.qos = qos;
+
+	return ioctl(QOS_IOCTL_SET_IP_QOS, &param);
+}
+
+int Device::set_multi_ip_qos(const struct qos_ioc_set_ip_qos_param *ip_qos,
+			     const __u64 *mask,
+			     __u32 num) noexcept
+{
+	struct qos_ioc_set_multi_ip_qos_param param = {};
+
+	param.ip_qos = const_cast<struct qos_ioc_set_ip_qos_param *>(ip_qos);
+	param.mask = const_cast<__u64 *>(mask);
+	param.num = num;
+
+	return ioctl(QOS_IOCTL_SET_MULTI_IP_QOS, &param);
+}
+
+int Device::set_all_qos(const __u64 *fix_qos,
+			const __u64 *be_qos) noexcept
+{
+	struct qos_ioc_set_all_qos_param param = {};
+
+	param.fix_qos = reinterpret_cast<__u8 *>(
+				const_cast<__u64 *>(fix_qos));
+	param.be_qos = reinterpret_cast<__u8 *>(
+				const_cast<__u64 *>(be_qos));
+
+	return ioctl(QOS_IOCTL_SET_ALL_QOS, &param);
+}
+
+int Device::switch_membank() noexcept
+{
+	return ioctl(QOS_IOCTL_SWITCH_MEMBANK, nullptr);
+}
+
+int Device::txn_begin(__u64 *gen) noexcept
+{
+	return ioctl(QOS_IOCTL_TXN_BEGIN, gen);
+}
+
+int Device::txn_set(const struct qos_ioc_set_ip_qos_param *ip_qos,
+		    const __u64 *mask, __u32 num) noexcept
+{
+	struct qos_ioc_set_multi_ip_qos_param param = {};
+
+	param.ip_qos = const_cast<struct qos_ioc_set_ip_qos_param *>(ip_qos);
+	param.mask = const_cast<__u64 *>(mask);
+	param.num = num;
+
+	return ioctl(QOS_IOCTL_TXN_SET, &param);
+}
+
+int Device::txn_commit(struct qos_ioc_txn_commit_param *param) noexcept
+{
+	return ioctl(QOS_IOCTL_TXN_COMMIT, param);
+}
+
+int Device::txn_abort() noexcept
+{
+	return ioctl(QOS_IOCTL_TXN_ABORT, nullptr);
+}
+
+} /* namespace rcar_qos */
@@ -0,0 +1,337 @@
+/*************************************************************************
+* qos_client.hpp
+*
+* Copyright (C) 2015-2017 Renesas Electronics Corporation
+*
+* License        Dual MIT/GPLv2
+*
+* The contents of this file are subject to the MIT license as set out below.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* Alternatively, the contents of this file may be used under the terms of
+* the GNU General Public License Version 2 ("GPL") in which case the provisions
+* of GPL are applicable instead of those above.
+*
+* If you wish to allow use of your version of this file only under the terms of
+* GPL, and not to allow others to use your version of this file under the terms
+* of the MIT license, indicate your decision by deleting the provisions above
+* and replace them with the notice and other provisions required by GPL as set
+* out in the file called "GPL-COPYING" included in this distribution. If you do
+* not delete the provisions above, a recipient may use your version of this file
+* under the terms of either the MIT license or GPL.
+*
+* This License is also included in this distribution in the file called
+* "MIT-COPYING".
+*
+* EXCEPT AS OTHERWISE STATED IN A NEGOTIATED AGREEMENT: (A) THE SOFTWARE IS
+* PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+* PURPOSE AND NONINFRINGEMENT; AND (B) IN NO EVENT SHALL THE AUTHORS OR
+* COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+* IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+* CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*
+* GPLv2:
+* If you wish to use this file under the terms of GPL, following terms are
+* effective.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*************************************************************************/
+#ifndef __QOS_CLIENT_HPP__
+#define __QOS_CLIENT_HPP__
+
+#include <array>
+#include <cstddef>
+#include <cerrno>
+
+#include "qos_public_common.h"
+
+namespace rcar_qos {
+
+/* Largest table the driver knows about: 4 KB, 512 entries of 8 bytes */
+constexpr std::size_t kTableEntries = 512;
+
+using Table = std::array<__u64, kTableEntries>;
+
+/*
+ * Move-only handle on /dev/qos. Every call returns 0 or a negative errno
+ * and none of them allocates.
+ */
+class Device {
+public:
+	Device() noexcept = default;
+	~Device();
+
+	Device(const Device &) = delete;
+	Device &operator=(const Device &) = delete;
+	Device(Device &&other) noexcept;
+	Device &operator=(Device &&other) noexcept;
+
+	int open(const char *path = "/dev/" QOS_DEVICE_NAME) noexcept;
+	void close() noexcept;
+
+	bool is_open() const noexcept { return fd_ >= 0; }
+	int fd() const noexcept { return fd_; }
+
+	/* master_id_max + 1 of the running SoC, valid once open */
+	__u32 master_num() const noexcept { return master_num_; }
+
+	int get_status(struct qos_ioc_get_status_param *status) noexcept;
+	int get_ip_qos(__u8 type, __u16 master_id,
+		       __u64 *qos,
+		       __u8 membank = QOS_MEMBANK_EXE) noexcept;
+
+	int set_ip_qos(__u8 type, __u16 master_id,
+		       __u64 qos) noexcept;
+	int set_multi_ip_qos(const struct qos_ioc_set_ip_qos_param *ip_qos,
+			     const __u64 *mask,
+			     __u32 num) noexcept;
+
+	/* Stage whole tables of master_num() entries into the standby bank */
+	int set_all_qos(const __u64 *fix_qos,
+			const __u64 *be_qos) noexcept;
+	int set_all_qos(const Table &fix_qos, const Table &be_qos) noexcept
+	{
+		return set_all_qos(fix_qos.data(), be_qos.data());
+	}
+
+	int switch_membank() noexcept;
+
+	int txn_begin(__u64 *gen) noexcept;
+	int txn_set(const struct qos_ioc_set_ip_qos_param *ip_qos,
+		    const __u64 *mask, __u32 num) noexcept;
+	int txn_commit(struct qos_ioc_txn_commit_param *param) noexcept;
+	int txn_abort() noexcept;
+
+private:
+	int ioctl(unsigned long request, void *arg) noexcept;
+
+	int fd_ = -1;
+	__u32 master_num_ = 0;
+};
+
+/*
+ * Fixed-capacity list of per-master edits, kept as the array the driver
+ * reads so that submitting it copies nothing. An edit of a master already
+ * in the batch is merged into its entry under the mask.
+ */
+template <std::size_t N = 64>
+class Batch {
+	static_assert(N > 0 && N <= QOS_MULTI_IP_QOS_NUM_MAX,
+		      "batch capacity out of range");
+
+public:
+	/* -ENOSPC once N distinct entries are held */
+	int set(__u8 type, __u16 master_id,
+		__u64 qos, __u64 mask = ~0ULL) noexcept
+	{
+		__u32 i;
+
+		if (type > QOS_TYPE_BE || mask == 0)
+			return -EINVAL;
+
+		for (i = 0; i < num_; i++) {
+			if (ip_qos_[i].master_id == master_id &&
+			    ip_qos_[i].qos_type == type)
+				break;
+		}
+
+		if (i == num_) {
+			if (num_ == N)
+				return -ENOSPC;
+			ip_qos_[i].qos_type = type;
+			ip_qos_[i].master_id = master_id;
+			ip_qos_[i].qos = 0;
+			mask_[i] = 0;
+			num_++;
+		}
+
+		ip_qos_[i].qos = (ip_qos_[i].qos & ~mask) | (qos & mask);
+		mask_[i] |= mask;
+		if (mask != ~0ULL)
+			masked_ = true;
+
+		return 0;
+	}
+
+	int fix(__u16 master_id, __u64 qos,
+		__u64 mask = ~0ULL) noexcept
+	{
+		return set(QOS_TYPE_FIX, master_id, qos, mask);
+	}
+
+	int be(__u16 master_id, __u64 qos,
+	       __u64 mask = ~0ULL) noexcept
+	{
+		return set(QOS_TYPE_BE, master_id, qos, mask);
+	}
+
+	void clear() noexcept
+	{
+		num_ = 0;
+		masked_ = false;
+	}
+
+	__u32 size() const noexcept { return num_; }
+	bool empty() const noexcept { return num_ == 0; }
+	static constexpr std::size_t capacity() noexcept { return N; }
+
+	const struct qos_ioc_set_ip_qos_param *ip_qos() const noexcept
+	{
+		return ip_qos_.data();
+	}
+
+	/* NULL when every entry is a full write, sparing the driver a copy */
+	const __u64 *mask() const noexcept
+	{
+		return masked_ ? mask_.data() : nullptr;
+	}
+
+	/* Stage the batch into the standby bank with one ioctl */
+	int apply(Device &dev) const noexcept
+	{
+		if (empty())
+			return 0;
+		return dev.set_multi_ip_qos(ip_qos(), mask(), num_);
+	}
+
+private:
+	std::array<struct qos_ioc_set_ip_qos_param, N> ip_qos_;
+	std::array<__u64, N> mask_;
+	__u32 num_ = 0;
+	bool masked_ = false;
+};
+
+/*
+ * Driver-side transaction on a Device, begun on construction and aborted
+ * on destruction unless committed. Edits are batched locally and sent on
+ * commit(). One transaction may be open per Device at a time.
+ */
+template <std::size_t N = 64>
+class Transaction {
+public:
+	explicit Transaction(Device &dev) noexcept : dev_(&dev)
+	{
+		error_ = dev_->txn_begin(&gen_);
+		if (error_)
+			dev_ = nullptr;
+	}
+
+	~Transaction() { abort(); }
+
+	Transaction(const Transaction &) = delete;
+	Transaction &operator=(const Transaction &) = delete;
+
+	Transaction(Transaction &&other) noexcept
+		: dev_(other.dev_), gen_(other.gen_), error_(other.error_),
+		  batch_(other.batch_)
+	{
+		other.dev_ = nullptr;
+	}
+
+	Transaction &operator=(Transaction &&other) noexcept
+	{
+		if (this != &other) {
+			abort();
+			dev_ = other.dev_;
+			gen_ = other.gen_;
+			error_ = other.error_;
+			batch_ = other.batch_;
+			other.dev_ = nullptr;
+		}
+		return *this;
+	}
+
+	/* Result of QOS_IOCTL_TXN_BEGIN */
+	int error() const noexcept { return error_; }
+	bool active() const noexcept { return dev_ != nullptr; }
+	__u64 generation() const noexcept { return gen_; }
+
+	int fix(__u16 master_id, __u64 qos,
+		__u64 mask = ~0ULL) noexcept
+	{
+		return batch_.fix(master_id, qos, mask);
+	}
+
+	int be(__u16 master_id, __u64 qos,
+	       __u64 mask = ~0ULL) noexcept
+	{
+		return batch_.be(master_id, qos, mask);
+	}
+
+	Batch<N> &batch() noexcept { return batch_; }
+
+	/*
+	 * Send the edits and commit them with a bank switch. On -EAGAIN the
+	 * transaction stays open and can be committed again with
+	 * QOS_TXN_FLAG_MERGE; any other result ends it.
+	 */
+	int commit(__u32 flags = 0, __u32 *conflicts = nullptr,
+		   __u8 *exe_membank = nullptr) noexcept
+	{
+		struct qos_ioc_txn_commit_param param = {};
+		int ret;
+
+		if (!active())
+			return -EINVAL;
+
+		if (!batch_.empty()) {
+			ret = dev_->txn_set(batch_.ip_qos(), batch_.mask(),
+					    batch_.size());
+			if (ret)
+				return ret;
+			batch_.clear();
+		}
+
+		param.flags = flags;
+		ret = dev_->txn_commit(&param);
+		if (conflicts)
+			*conflicts = param.conflicts;
+		if (exe_membank)
+			*exe_membank = param.exe_membank;
+
+		if (ret != -EAGAIN)
+			dev_ = nullptr;
+
+		return ret;
+	}
+
+	void abort() noexcept
+	{
+		if (active()) {
+			dev_->txn_abort();
+			dev_ = nullptr;
+		}
+	}
+
+private:
+	Device *dev_;
+	__u64 gen_ = 0;
+	int error_ = 0;
+	Batch<N> batch_;
+};
+
+} /* namespace rcar_qos */
+
+#endif /* __QOS_CLIENT_HPP__ */
@@ -0,0 +1,265 @@
+/*************************************************************************/ /*
+ qos_mkfw.c
+
+ Copyright (C) 2021 Renesas Electronics Corporation
+
+ License        Dual MIT/GPLv2
+
+ The contents of this file are subject to the MIT license as set out below.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ Alternatively, the contents of this file may be used under the terms of
+ the GNU General Public License Version 2 ("GPL") in which case the provisions
+ of GPL are applicable instead of those above.
+
+ If you wish to allow use of your version of this file only under the terms of
+ GPL, and not to allow others to use your version of this file under the terms
+ of the MIT license, indicate your decision by deleting the provisions above
+ and replace them with the notice and other provisions required by GPL as set
+ out in the file called "GPL-COPYING" included in this distribution. If you do
+ not delete the provisions above, a recipient may use your version of this file
+ under the terms of either the MIT license or GPL.
+
+ This License is also included in this distribution in the file called
+ "MIT-COPYING".
+
+ EXCEPT AS OTHERWISE STATED IN A NEGOTIATED AGREEMENT: (A) THE SOFTWARE IS
+ PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ PURPOSE AND NONINFRINGEMENT; AND (B) IN NO EVENT SHALL THE AUTHORS OR
+ COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+ GPLv2:
+ If you wish to use this file under the terms of GPL, following terms are
+ effective.
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; version 2 of the License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/ /*************************************************************************/
+
+/*
+ * Builds a profile image for request_firmware() from a text description:
+ *
+ *   # comment
+ *   soc <master_id_max> [<PRR product ID>]
+ *   active <profile id>
+ *   profile <id> <name>
+ *   fix <master_id> <qos>
+ *   be <master_id> <qos>
+ *
+ * fix and be lines add entries to the last profile. Numbers may be given
+ * in decimal or with a 0x prefix.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qos_public_common.h"
+
+/* MASTER_ID_MAX in qos_reg.h */
+#define QOS_MKFW_MASTER_ID_MAX	511
+
+static unsigned char *image;
+static size_t image_size;
+static size_t image_alloc;
+
+static void *image_grow(size_t size)
+{
+	void *p;
+
+	if (image_size + size > image_alloc) {
+		image_alloc = (image_size + size) * 2;
+		image = realloc(image, image_alloc);
+		if (image == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	p = image + image_size;
+	memset(p, 0, size);
+	image_size += size;
+
+	return p;
+}
+
+/* CRC-32 as computed by zlib, and by crc32_le(~0, ...) ^ ~0 in the kernel */
+static __u32 crc32(const unsigned char *data, size_t size)
+{
+	__u32 crc = 0xFFFFFFFF;
+	size_t i;
+	int bit;
+
+	for (i = 0; i < size; i++) {
+		crc ^= data[i];
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+static int parse(FILE *in, const char *path)
+{
+	struct qos_fw_header *hdr;
+	struct qos_fw_profile *prof;
+	size_t prof_off = 0;
+	long long value;
+	long master_id;
+	int master_id_max = -1;
+	int profile_num = 0;
+	char defined[QOS_PROFILE_NUM] = { 0 };
+	char line[256];
+	char word[32];
+	char name[64];
+	long a;
+	long b;
+	int lineno = 0;
+	int n;
+
+	hdr = image_grow(sizeof(*hdr));
+	hdr->magic = htole32(QOS_FW_MAGIC);
+	hdr->version = htole16(QOS_FW_VERSION);
+	hdr->active_id = htole16(QOS_FW_ACTIVE_NONE);
+
+	while (fgets(line, sizeof(line), in)) {
+		lineno++;
+		if ((sscanf(line, "%31s", word) != 1) || (word[0] == '#'))
+			continue;
+
+		hdr = (struct qos_fw_header *)image;
+
+		if (!strcmp(word, "soc")) {
+			a = 0;
+			b = 0;
+			n = sscanf(line, "%*s %li %li", &a, &b);
+			if ((n < 1) || (a < 0) || (a > QOS_MKFW_MASTER_ID_MAX) ||
+			    (b < 0))
+				goto err;
+			master_id_max = a;
+			hdr->master_id_max = htole16(a);
+			hdr->product = htole32(b);
+		} else if (!strcmp(word, "active")) {
+			if ((sscanf(line, "%*s %li", &a) != 1) || (a < 0) ||
+			    (a >= QOS_PROFILE_NUM))
+				goto err;
+			hdr->active_id = htole16(a);
+		} else if (!strcmp(word, "profile")) {
+			if ((sscanf(line, "%*s %li %63s", &a, name) != 2) ||
+			    (a < 0) || (a >= QOS_PROFILE_NUM) ||
+			    (strlen(name) >= QOS_PROFILE_NAME_LEN))
+				goto err;
+			prof_off = image_size;
+			prof = image_grow(sizeof(*prof));
+			prof->id = htole32(a);
+			strcpy(prof->name, name);
+			defined[a] = 1;
+			profile_num++;
+		} else if (!strcmp(word, "fix") || !strcmp(word, "be")) {
+			struct qos_fw_entry *entry;
+
+			if ((prof_off == 0) || (master_id_max < 0) ||
+			    (sscanf(line, "%*s %li %lli", &master_id, &value) != 2) ||
+			    (master_id < 0) || (master_id > master_id_max))
+				goto err;
+			entry = image_grow(sizeof(*entry));
+			entry->qos = htole64(value);
+			entry->master_id = htole16(master_id);
+			entry->qos_type = strcmp(word, "fix") ?
+						QOS_TYPE_BE : QOS_TYPE_FIX;
+			prof = (struct qos_fw_profile *)(image + prof_off);
+			prof->entry_num = htole16(le16toh(prof->entry_num) + 1);
+		} else {
+			goto err;
+		}
+	}
+
+	if (master_id_max < 0) {
+		fprintf(stderr, "%s: no soc line\n", path);
+		return -EINVAL;
+	}
+
+	hdr = (struct qos_fw_header *)image;
+
+	/* The driver rejects an image whose active profile is not in it */
+	a = le16toh(hdr->active_id);
+	if ((a != QOS_FW_ACTIVE_NONE) && !defined[a]) {
+		fprintf(stderr, "%s: active profile %ld is not defined\n",
+			path, a);
+		return -EINVAL;
+	}
+
+	hdr->profile_num = htole16(profile_num);
+	hdr->size = htole32(image_size);
+	hdr->checksum = htole32(crc32(image
+				+ offsetof(struct qos_fw_header, version),
+				image_size
+				- offsetof(struct qos_fw_header, version)));
+
+	return 0;
+
+err:
+	fprintf(stderr, "%s:%d: invalid line\n", path, lineno);
+	return -EINVAL;
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *in;
+	FILE *out;
+	int ret;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <profiles.txt> <%s>\n", argv[0],
+			QOS_FW_NAME);
+		return 1;
+	}
+
+	in = fopen(argv[1], "r");
+	if (in == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	ret = parse(in, argv[1]);
+	fclose(in);
+	if (ret)
+		return 1;
+
+	out = fopen(argv[2], "wb");
+	if ((out == NULL) || (fwrite(image, image_size, 1, out) != 1) ||
+	    fclose(out)) {
+		perror(argv[2]);
+		return 1;
+	}
+
+	free(image);
+
+	return 0;
+}